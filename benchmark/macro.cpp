@@ -72,17 +72,26 @@ using namespace entt;
 class EntidyBenchmark : public BenchmarkTarget
 {
 	size_t count;
+	StoragePolicy storage;
+
+	void SetStorage(shared_ptr<entidy::Entidy> registry)
+	{
+		for(auto key : {"Comp1", "Comp2", "Comp3", "Comp4", "Comp5", "Comp6", "Comp7"})
+			registry->Storage(key, storage);
+	}
 
 public:
-	EntidyBenchmark(size_t count)
+	EntidyBenchmark(size_t count, StoragePolicy storage = StoragePolicy::Pooled)
 	{
 		this->count = count;
+		this->storage = storage;
 	}
 
 	virtual void Scenario1(unsigned int seed) override
 	{
 		auto proba = UniformRandom<float>{seed};
 		auto registry = make_shared<entidy::Entidy>();
+		SetStorage(registry);
 		auto t0 = timer{};
 
 		for(size_t i = 0; i < count; i++)
@@ -157,6 +166,7 @@ public:
 	{
 		auto proba = UniformRandom<float>{seed};
 		auto registry = make_shared<entidy::Entidy>();
+		SetStorage(registry);
 
 		for(size_t i = 0; i < count; i++)
 		{
@@ -188,6 +198,174 @@ public:
 		});
 		t0.elapsed();
 	}
+
+	// Same data as Scenario2, iterated with View::ParallelEach on a given number of threads
+	void ParallelScenario(unsigned int seed, size_t threads)
+	{
+		auto proba = UniformRandom<float>{seed};
+		auto registry = make_shared<entidy::Entidy>();
+		SetStorage(registry);
+		registry->Threads(threads);
+
+		for(size_t i = 0; i < count; i++)
+		{
+			Entity e = registry->Create();
+			registry->Emplace<Comp<1>>(e, "Comp1");
+			if(proba(0.5))
+				registry->Emplace<Comp<3>>(e, "Comp3");
+			if(proba(0.5))
+				registry->Emplace<Comp<5>>(e, "Comp5");
+		}
+		registry->Commit();
+
+		auto query = registry->Select({"Comp1", "Comp3", "Comp5"});
+		auto it = query.Having("Comp1 & Comp3 & Comp5");
+
+		// Warm up the thread pool
+		it.ParallelEach([&](Entity e, Comp<1>* comp1, Comp<3>* comp3, Comp<5>* comp5) { });
+
+		auto t0 = timer{};
+		it.ParallelEach([&](Entity e, Comp<1>* comp1, Comp<3>* comp3, Comp<5>* comp5) {
+			for(size_t k = 0; k < sizeof(comp1->a); k++)
+				comp1->a[k] = char(e + k);
+			comp3->a[0] = comp1->a[1];
+			comp5->a[0] = comp1->a[2];
+		});
+		t0.elapsed();
+	}
+
+	// Waves of entities that are created, then mostly removed, leaving the survivors scattered across sparsely used blocks.
+	// Iterates over them before and after CleanUp compacts the pools, and prints the blocks released
+	void ChurnScenario(unsigned int seed)
+	{
+		auto proba = UniformRandom<float>{seed};
+		auto registry = make_shared<entidy::Entidy>();
+
+		vector<Entity> entities;
+		for(size_t wave = 0; wave < 4; wave++)
+		{
+			for(size_t i = 0; i < count; i++)
+			{
+				Entity e = registry->Create();
+				registry->Emplace<Comp<1>>(e, "Comp1");
+				registry->Emplace<Comp<2>>(e, "Comp2");
+				entities.push_back(e);
+			}
+			registry->Commit();
+
+			vector<Entity> survivors;
+			for(Entity e : entities)
+			{
+				if(proba(0.75))
+					registry->Erase(e);
+				else
+					survivors.push_back(e);
+			}
+			entities.swap(survivors);
+			registry->Commit();
+		}
+
+		auto query = registry->Select({"Comp1", "Comp2"});
+		auto it = query.Having("Comp1 & Comp2");
+		auto iterate = [&]() {
+			timer t;
+			for(size_t pass = 0; pass < 10; pass++)
+			{
+				it.Each([&](Entity e, Comp<1>* comp1, Comp<2>* comp2) {
+					for(size_t k = 0; k < sizeof(comp1->a); k++)
+						comp1->a[k] += comp2->a[k];
+				});
+			}
+			t.elapsed();
+		};
+		auto blocks = [&]() {
+			size_t total = 0;
+			for(auto& component : registry->MemoryStats().components)
+				total += component.pool.blocks;
+			return total;
+		};
+
+		cout << entities.size() << " entities in " << blocks() << " blocks, 10 passes in ";
+		iterate();
+
+		timer t0;
+		registry->CleanUp(true);
+		registry->Commit();
+		cout << "Compacted in ";
+		t0.elapsed();
+
+		it = query.Having("Comp1 & Comp2");
+		cout << entities.size() << " entities in " << blocks() << " blocks, 10 passes in ";
+		iterate();
+	}
+
+	// The phases of Scenario1, replicated after every commit: prints the size of each delta and the time to apply it
+	void ReplicationScenario(unsigned int seed)
+	{
+		auto proba = UniformRandom<float>{seed};
+		auto registry = make_shared<entidy::Entidy>();
+		auto replica = make_shared<entidy::Entidy>();
+		SetStorage(registry);
+		SetStorage(replica);
+		replica->Register<Comp<1>>("Comp1");
+		replica->Register<Comp<2>>("Comp2");
+		replica->Register<Comp<3>>("Comp3");
+		replica->Register<Comp<4>>("Comp4");
+		replica->Register<Comp<5>>("Comp5");
+		for(auto key : {"Comp1", "Comp2", "Comp3", "Comp4", "Comp5"})
+		{
+			registry->Track(key);
+			replica->Track(key);
+		}
+		registry->Replicate();
+
+		auto replicate = [&]() {
+			registry->Commit();
+			auto delta = registry->CaptureDelta();
+			cout << delta.size() / 1024 << " KB, applied in ";
+			timer t;
+			replica->ApplyDelta(delta);
+			t.elapsed();
+		};
+
+		for(size_t i = 0; i < count; i++)
+		{
+			auto e = registry->Create();
+			registry->Emplace<Comp<1>>(e, "Comp1");
+		}
+		replicate();
+
+		registry->Select({"Comp1"}).Having("Comp1").Each([&](Entity e, Comp<1>* comp1) {
+			if(proba(0.25))
+				registry->Emplace<Comp<2>>(e, "Comp2");
+			if(proba(0.25))
+				registry->Emplace<Comp<3>>(e, "Comp3");
+			if(proba(0.25))
+				registry->Emplace<Comp<4>>(e, "Comp4");
+			if(proba(0.25))
+				registry->Emplace<Comp<5>>(e, "Comp5");
+		});
+		replicate();
+
+		registry->Select({"Comp2", "Comp3"}).Having("Comp2 & Comp3").EachMut([&](Entity e, Comp<2>* comp2, Comp<3>* comp3) {
+			comp2->a[0] = 1;
+			comp3->a[0] = 1;
+			if(proba(0.25))
+				registry->Erase(e, "Comp2");
+			if(proba(0.25))
+				registry->Erase(e, "Comp3");
+		});
+		replicate();
+
+		registry->Select({"Comp4", "Comp5"}).Having("Comp4 & Comp5").Each([&](Entity e, Comp<4>* comp4, Comp<5>* comp5) {
+			if(proba(0.25))
+				registry->Erase(e);
+		});
+		replicate();
+
+		registry->Select({"Comp1"}).Having("Comp1").Each([&](Entity e, Comp<1>* comp1) { registry->Erase(e); });
+		replicate();
+	}
 };
 
 class EnTTBenchmark : public BenchmarkTarget
@@ -305,6 +483,8 @@ int main(int argc, char** argv)
 	using namespace entidy_benchmark;
 
 	size_t count = 10000000;
+	if(argc > 1)
+		count = std::stoul(argv[1]);
 
 	cout << "Scenario 1" << endl;
 	cout << "OURS" << endl;
@@ -313,6 +493,12 @@ int main(int argc, char** argv)
 		ours->Scenario1(1);
 	}
 	std::this_thread::sleep_for(1s);
+	cout << "OURS (packed)" << endl;
+	{
+		shared_ptr<BenchmarkTarget> ours = make_shared<EntidyBenchmark>(count, StoragePolicy::Packed);
+		ours->Scenario1(1);
+	}
+	std::this_thread::sleep_for(1s);
 	cout << "ENTT" << endl;
 	{
 		shared_ptr<BenchmarkTarget> entt = make_shared<EnTTBenchmark>(count);
@@ -328,11 +514,46 @@ int main(int argc, char** argv)
 		ours->Scenario2(1);
 	}
 	std::this_thread::sleep_for(1s);
+	cout << "OURS (packed)" << endl;
+	{
+		shared_ptr<BenchmarkTarget> ours = make_shared<EntidyBenchmark>(count, StoragePolicy::Packed);
+		ours->Scenario2(1);
+	}
+	std::this_thread::sleep_for(1s);
 	cout << "ENTT" << endl;
 	{
 		shared_ptr<BenchmarkTarget> entt = make_shared<EnTTBenchmark>(count);
 		entt->Scenario2(1);
 	}
 
+	std::this_thread::sleep_for(1s);
+
+	cout << "Parallel iteration" << endl;
+	size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+	for(size_t threads = 1;; threads = std::min(threads * 2, hardware))
+	{
+		cout << "OURS (" << threads << " threads)" << endl;
+		EntidyBenchmark ours(count);
+		ours.ParallelScenario(1, threads);
+		if(threads == hardware)
+			break;
+	}
+
+	std::this_thread::sleep_for(1s);
+
+	cout << "Replication" << endl;
+	{
+		EntidyBenchmark ours(count);
+		ours.ReplicationScenario(1);
+	}
+
+	std::this_thread::sleep_for(1s);
+
+	cout << "Churn" << endl;
+	{
+		EntidyBenchmark ours(count);
+		ours.ChurnScenario(1);
+	}
+
 	return 0;
 }
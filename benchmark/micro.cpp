@@ -47,12 +47,14 @@ TEST_CASE("Creating 100000 entities")
 
 	BENCHMARK_ADVANCED("entidy")(Catch::Benchmark::Chronometer meter)
 	{
-		auto registry = std::make_shared<entidy::Entidy>();
+		std::vector<std::unique_ptr<entidy::Entidy>> registries;
+		for(auto run = 0; run < meter.runs(); run++)
+			registries.push_back(std::make_unique<entidy::Entidy>());
 
-		meter.measure([&]() {
+		meter.measure([&](int run) {
 			for(auto i = 0; i < 1000000L; i++)
 			{
-				registry->Create();
+				registries[run]->Create();
 			}
 		});
 	};
@@ -70,14 +72,14 @@ TEST_CASE("Creating 100000 entities Bulk")
 
 	BENCHMARK_ADVANCED("entidy")(Catch::Benchmark::Chronometer meter)
 	{
-		auto registry = std::make_shared<entidy::Entidy>();
+		std::vector<std::unique_ptr<entidy::Entidy>> registries;
+		for(auto run = 0; run < meter.runs(); run++)
+			registries.push_back(std::make_unique<entidy::Entidy>());
 
-		auto entities = entidy_vector_of_n_entities(100000);
-
-		meter.measure([&]() {
+		meter.measure([&](int run) {
 			for(auto i = 0; i < 1000000L; i++)
 			{
-				registry->Create();
+				registries[run]->Create();
 			}
 		});
 	};
@@ -160,6 +162,47 @@ TEST_CASE("Creating 100000 entities + Emplace Bulk Components")
 	};
 }
 
+TEST_CASE("Emplacing and committing 100000 components")
+{
+	BENCHMARK_ADVANCED("ENTT")
+	(Catch::Benchmark::Chronometer meter)
+	{
+		entt::registry registry;
+		auto entities = entt_vector_of_n_entities(100000);
+
+		registry.create(entities.begin(), entities.end());
+
+		meter.measure([&]() {
+			for(const auto entity : entities)
+			{
+				registry.emplace_or_replace<Component<3 * word_size>>(entity);
+				registry.emplace_or_replace<Component<8 * word_size>>(entity);
+			}
+		});
+	};
+
+	BENCHMARK_ADVANCED("entidy")(Catch::Benchmark::Chronometer meter)
+	{
+		auto registry = std::make_shared<entidy::Entidy>();
+
+		auto entities = entidy_vector_of_n_entities(100000);
+
+		for(auto i = 0; i < entities.size(); i++)
+		{
+			registry->Create();
+		}
+
+		meter.measure([&]() {
+			for(const auto entity : entities)
+			{
+				registry->Emplace(entity, "Comp003xWord", Component<3 * word_size>{});
+				registry->Emplace(entity, "Comp008xWord", Component<8 * word_size>{});
+			}
+			registry->Commit();
+		});
+	};
+}
+
 TEST_CASE("Removing 100000 components from their entities")
 {
 	BENCHMARK_ADVANCED("ENTT")
@@ -258,6 +301,47 @@ TEST_CASE("Removing 100000 components from their entities at once")
 	};
 }
 
+// Erases and re-emplaces 10000 components spread over a pool of 'blocks' blocks.
+// The cost should not depend on the number of blocks in the pool.
+void entidy_pool_erase_with_n_blocks(Catch::Benchmark::Chronometer& meter, size_t blocks)
+{
+	auto pool = entidy::MemoryManagerImpl::Create<Component<word_size>>(1024);
+
+	std::vector<Component<word_size>*> items;
+	while(pool->Blocks() < blocks)
+		items.push_back(pool->Pop<Component<word_size>>());
+
+	std::vector<Component<word_size>*> sample(10000);
+	for(size_t i = 0; i < sample.size(); i++)
+		sample[i] = items[i * items.size() / sample.size()];
+
+	meter.measure([&]() {
+		for(auto& item : sample)
+		{
+			pool->Push((intptr_t)item);
+			item = pool->Pop<Component<word_size>>();
+		}
+	});
+}
+
+TEST_CASE("Erasing 10000 components from pools with a growing number of blocks")
+{
+	BENCHMARK_ADVANCED("entidy 16 blocks")(Catch::Benchmark::Chronometer meter)
+	{
+		entidy_pool_erase_with_n_blocks(meter, 16);
+	};
+
+	BENCHMARK_ADVANCED("entidy 256 blocks")(Catch::Benchmark::Chronometer meter)
+	{
+		entidy_pool_erase_with_n_blocks(meter, 256);
+	};
+
+	BENCHMARK_ADVANCED("entidy 4096 blocks")(Catch::Benchmark::Chronometer meter)
+	{
+		entidy_pool_erase_with_n_blocks(meter, 4096);
+	};
+}
+
 TEST_CASE("Destorying 100000 entities")
 {
 	BENCHMARK_ADVANCED("ENTT")
@@ -276,6 +360,34 @@ TEST_CASE("Destorying 100000 entities")
 			}
 		});
 	};
+
+	BENCHMARK_ADVANCED("entidy")(Catch::Benchmark::Chronometer meter)
+	{
+		auto entities = entidy_vector_of_n_entities(100000);
+		std::vector<std::unique_ptr<entidy::Entidy>> registries;
+
+		for(auto run = 0; run < meter.runs(); run++)
+		{
+			registries.push_back(std::make_unique<entidy::Entidy>());
+			for(auto i = 0; i < entities.size(); i++)
+			{
+				registries.back()->Create();
+			}
+			for(const auto entity : entities)
+			{
+				registries.back()->Emplace(entity, "CompInt", 0);
+			}
+			registries.back()->Commit();
+		}
+
+		meter.measure([&](int run) {
+			for(const auto entity : entities)
+			{
+				registries[run]->Erase(entity);
+			}
+			registries[run]->Commit();
+		});
+	};
 }
 
 TEST_CASE("Destorying 100000 entities Bulk")
@@ -296,3 +408,50 @@ TEST_CASE("Destorying 100000 entities Bulk")
 		});
 	};
 }
+
+// Spawns 100000 entities with two components into a new registry, in frames of 1000 entities, with or without size hints.
+// Hinted registries allocate their memory before the measurement, so frames do not grow pools and sparse vectors.
+void entidy_spawn_in_frames(Catch::Benchmark::Chronometer& meter, bool hinted)
+{
+	std::vector<std::shared_ptr<entidy::Entidy>> registries;
+	for(int run = 0; run < meter.runs(); run++)
+	{
+		auto registry = std::make_shared<entidy::Entidy>();
+		if(hinted)
+		{
+			registry->Reserve(100000);
+			registry->SizeHint("Comp003xWord", 100000);
+			registry->SizeHint("Comp008xWord", 100000);
+		}
+		registry->Register<Component<3 * word_size>>("Comp003xWord");
+		registry->Register<Component<8 * word_size>>("Comp008xWord");
+		registries.push_back(registry);
+	}
+
+	meter.measure([&](int run) {
+		auto& registry = registries[run];
+		for(size_t frame = 0; frame < 100; frame++)
+		{
+			for(size_t i = 0; i < 1000; i++)
+			{
+				auto entity = registry->Create();
+				registry->Emplace(entity, "Comp003xWord", Component<3 * word_size>{});
+				registry->Emplace(entity, "Comp008xWord", Component<8 * word_size>{});
+			}
+			registry->Commit();
+		}
+	});
+}
+
+TEST_CASE("Spawning 100000 entities in frames")
+{
+	BENCHMARK_ADVANCED("entidy")(Catch::Benchmark::Chronometer meter)
+	{
+		entidy_spawn_in_frames(meter, false);
+	};
+
+	BENCHMARK_ADVANCED("entidy with size hints")(Catch::Benchmark::Chronometer meter)
+	{
+		entidy_spawn_in_frames(meter, true);
+	};
+}
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <entidy/Entidy.h>
+#include <exception>
+#include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <termios.h>
 #include <unistd.h>
 #include <vector>
@@ -21,11 +27,48 @@ class EngineImpl;
 
 using Engine = shared_ptr<EngineImpl>;
 
+// The components and resources that a system accesses during Update.
+// 'reads' and 'writes' are component keys: instances modified in place or emplaced are writes,
+// and every key used in a Select or a filter must be listed. Erasing is deferred and needs no declaration.
+// 'resources' are engine state shared outside of the registry (e.g. the console), always accessed exclusively.
+// Exclusive systems conflict with every other system.
+struct SystemAccess
+{
+	vector<string> reads;
+	vector<string> writes;
+	vector<string> resources;
+	bool exclusive = false;
+
+	bool Conflicts(const SystemAccess& other) const
+	{
+		if(exclusive || other.exclusive)
+			return true;
+
+		auto intersects = [](const vector<string>& lhs, const vector<string>& rhs) {
+			for(auto& key : lhs)
+				if(find(rhs.begin(), rhs.end(), key) != rhs.end())
+					return true;
+			return false;
+		};
+
+		return intersects(writes, other.reads) || intersects(writes, other.writes) || intersects(reads, other.writes)
+			   || intersects(resources, other.resources);
+	}
+};
+
 class System
 {
 public:
 	virtual void Init(Engine engine) = 0;
 	virtual void Update(Engine engine) = 0;
+
+	// Systems that do not declare their access never run concurrently with other systems.
+	virtual SystemAccess Access()
+	{
+		SystemAccess access;
+		access.exclusive = true;
+		return access;
+	}
 };
 
 struct timer final
@@ -51,11 +94,85 @@ protected:
 	Console console;
 
 	vector<shared_ptr<System>> systems;
+	vector<double> timings;
 
 	deque<char> input_buffer;
 
 	bool running = true;
 
+	// Runs the Update of every system, concurrently on the registry's thread pool when their access does not conflict.
+	// A system waits for all the earlier systems it conflicts with, so conflicting systems keep the order they were added in.
+	void Schedule()
+	{
+		Engine engine = shared_from_this();
+		size_t count = systems.size();
+
+		vector<SystemAccess> access(count);
+		vector<string> keys;
+		for(size_t i = 0; i < count; i++)
+		{
+			access[i] = systems[i]->Access();
+			keys.insert(keys.end(), access[i].reads.begin(), access[i].reads.end());
+			keys.insert(keys.end(), access[i].writes.begin(), access[i].writes.end());
+		}
+		// Creates the components that do not exist yet, so that systems only look keys up while running.
+		// A system that emplaces a key conflicts with every system that reads it, so the first Emplace that sets the type of
+		// a key never runs alongside another use of the key. No system reads the set of alive entities (Alive, Has, Component,
+		// queries with '!'), so systems can create entities concurrently.
+		registry->Declare(keys);
+
+		vector<vector<size_t>> dependents(count);
+		unique_ptr<atomic<size_t>[]> dependencies(new atomic<size_t>[count]);
+		vector<size_t> ready;
+		for(size_t j = 0; j < count; j++)
+		{
+			dependencies[j] = 0;
+			for(size_t i = 0; i < j; i++)
+			{
+				if(access[i].Conflicts(access[j]))
+				{
+					dependents[i].push_back(j);
+					dependencies[j]++;
+				}
+			}
+			if(dependencies[j] == 0)
+				ready.push_back(j);
+		}
+
+		ThreadPool pool = registry->Pool();
+		atomic<size_t> remaining{count};
+		exception_ptr error;
+		mutex error_lock;
+		timings.assign(count, 0);
+
+		function<void(size_t)> run = [&](size_t i) {
+			timer t;
+			try
+			{
+				systems[i]->Update(engine);
+			}
+			catch(...)
+			{
+				lock_guard<mutex> guard(error_lock);
+				if(!error)
+					error = current_exception();
+			}
+			timings[i] = t.elapsed();
+
+			for(size_t j : dependents[i])
+				if(--dependencies[j] == 0)
+					pool->Submit([&run, j]() { run(j); });
+			remaining--;
+		};
+
+		for(size_t i : ready)
+			pool->Submit([&run, i]() { run(i); });
+		pool->Wait([&remaining]() { return remaining == 0; });
+
+		if(error)
+			rethrow_exception(error);
+	}
+
 public:
 	EngineImpl()
 	{
@@ -109,6 +226,12 @@ public:
 		return &input_buffer;
 	}
 
+	// Seconds spent in the Update of each system during the last frame, in the order the systems were added.
+	const vector<double>& Timings() const
+	{
+		return timings;
+	}
+
 	void Run()
 	{
 		for(auto& it : systems)
@@ -126,10 +249,7 @@ public:
 				future = std::async(std::launch::async, &EngineImpl::GetChar, this);
 			}
 
-			for(auto& it : systems)
-			{
-				it->Update(shared_from_this());
-			}
+			Schedule();
             registry->Commit();
 
 			console->Render();
@@ -13,6 +13,7 @@ class SBackground : public System
 public:
 	virtual void Init(Engine engine) override;
 	virtual void Update(Engine engine) override;
+	virtual SystemAccess Access() override;
 };
 
 }
\ No newline at end of file
@@ -14,6 +14,7 @@ protected:
 public:
 	virtual void Init(Engine engine) override;
 	virtual void Update(Engine engine) override;
+	virtual SystemAccess Access() override;
 };
 
 } // namespace entidy::spaceinvaders
\ No newline at end of file
@@ -1,4 +1,6 @@
 #pragma once
+#include <optional>
+
 #include "Components.h"
 #include "Engine.h"
 #include "Helper.h"
@@ -11,10 +13,12 @@ using namespace entidy;
 class SMovement : public System
 {
 protected:
+	optional<CompiledQuery> query_bounce;
 
 public:
 	virtual void Init(Engine engine) override;
 	virtual void Update(Engine engine) override;
+	virtual SystemAccess Access() override;
 };
 
 } // namespace entidy::spaceinvaders
\ No newline at end of file
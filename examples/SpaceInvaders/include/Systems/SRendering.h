@@ -1,4 +1,6 @@
 #pragma once
+#include <optional>
+
 #include "Components.h"
 #include "Engine.h"
 #include "Helper.h"
@@ -11,6 +13,8 @@ using namespace entidy;
 class SRendering : public System
 {
 protected:
+	optional<Observer> sprites;
+
     void RenderSprites(Engine engine);
 	void RenderInvalidSize(Engine engine);
 	void RenderBackground(Engine engine);
@@ -22,6 +26,7 @@ protected:
 public:
 	virtual void Init(Engine engine) override;
 	virtual void Update(Engine engine) override;
+	virtual SystemAccess Access() override;
 };
 
 } // namespace entidy::spaceinvaders
\ No newline at end of file
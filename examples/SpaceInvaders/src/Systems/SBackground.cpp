@@ -15,6 +15,13 @@ void SBackground::Init(Engine engine)
 	}
 }
 
+SystemAccess SBackground::Access()
+{
+	SystemAccess access;
+	access.writes = {"BGFXRipple"};
+	return access;
+}
+
 void SBackground::Update(Engine engine)
 {
 	View view_ripple = engine->Registry()->Select({"BGFXRipple"}).Having("BGFXRipple");
@@ -9,6 +9,14 @@ void SEnemy::Init(Engine engine)
 	engine->Registry()->Emplace<int>(e, "EnemySpawn", 1);
 }
 
+SystemAccess SEnemy::Access()
+{
+	SystemAccess access;
+	access.reads = {"Bullet", "Enemy"};
+	access.writes = {"EnemySpawn", "Health", "Position", "Sprite", "Velocity", "BoundaryAction", "Enemy", "BGFXRipple"};
+	return access;
+}
+
 void SEnemy::Update(Engine engine)
 {
 	auto spawn_view = engine->Registry()->Select({"EnemySpawn"}).Having("EnemySpawn");
@@ -5,6 +5,14 @@ using namespace entidy::spaceinvaders;
 
 void SInput::Init(Engine engine) { }
 
+SystemAccess SInput::Access()
+{
+	SystemAccess access;
+	access.writes = {"InputCommand"};
+	access.resources = {"Input"};
+	return access;
+}
+
 void SInput::Update(Engine engine)
 {
 	auto input_buffer = engine->InputBuffer();
@@ -3,11 +3,22 @@
 using namespace entidy;
 using namespace entidy::spaceinvaders;
 
-void SMovement::Init(Engine engine) { }
+void SMovement::Init(Engine engine)
+{
+	query_bounce = engine->Registry()->Select({"Position", "Velocity", "BoundaryAction"}).Compile("Position & Velocity & BoundaryAction");
+}
+
+SystemAccess SMovement::Access()
+{
+	SystemAccess access;
+	access.reads = {"BoundaryAction"};
+	access.writes = {"Position", "Velocity"};
+	return access;
+}
 
 void SMovement::Update(Engine engine)
 {
-	View view_bounce = engine->Registry()->Select({"Position", "Velocity", "BoundaryAction"}).Having("Position & Velocity & BoundaryAction");
+	View view_bounce = query_bounce->Execute();
 	view_bounce.Each([&](Entity e, Vec2f* position, Vec2f* velocity, BoundaryAction* boundary_action) {
 		position->x += velocity->x;
 		position->y += velocity->y;
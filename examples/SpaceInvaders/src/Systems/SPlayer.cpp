@@ -11,6 +11,14 @@ void SPlayer::Init(Engine engine)
 	engine->Registry()->Emplace<u_int8_t>(e, "Player");
 }
 
+SystemAccess SPlayer::Access()
+{
+	SystemAccess access;
+	access.reads = {"InputCommand", "Player", "Sprite"};
+	access.writes = {"Position", "Velocity", "BoundaryAction", "Sprite", "Bullet"};
+	return access;
+}
+
 void SPlayer::Update(Engine engine)
 {
 
@@ -3,7 +3,19 @@
 using namespace entidy;
 using namespace entidy::spaceinvaders;
 
-void SRendering::Init(Engine engine) { }
+void SRendering::Init(Engine engine)
+{
+	sprites = engine->Registry()->Select({"Sprite", "Position"}).Observe("Sprite & Position");
+}
+
+SystemAccess SRendering::Access()
+{
+	SystemAccess access;
+	access.reads = {"Position", "BGFXFog", "BGFXRipple"};
+	access.writes = {"Sprite"};
+	access.resources = {"Console"};
+	return access;
+}
 
 void SRendering::Update(Engine engine)
 {
@@ -56,7 +68,7 @@ void SRendering::RenderSprites(Engine engine)
 	ushort offset_x = (engine->Renderer()->Cols() - VIEWPORT_W) / 2;
 	ushort offset_y = (engine->Renderer()->Rows() - VIEWPORT_H) / 2;
 
-	auto sprite_view = engine->Registry()->Select({"Sprite", "Position"}).Having("Sprite & Position");
+	auto sprite_view = sprites->Execute();
 	sprite_view.Each([&](Entity e, Sprite* sprite, Vec2f* position) {
 		ushort start_x = offset_x + position->x - floor(float(sprite->cols) / 2.0);
 		ushort start_y = offset_y + position->y - floor(float(sprite->rows) / 2.0);
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include <entidy/Entity.h>
+
+#ifndef ENTIDY_ARCHETYPE_CHUNK_SIZE
+#	define ENTIDY_ARCHETYPE_CHUNK_SIZE 512
+#endif
+
+namespace entidy
+{
+using namespace std;
+
+// Bitmap: views intersect the bitmaps of the components and read component addresses from their sparse vectors.
+// Archetype: compiled queries also scan the tables of the entities that share the matching component signatures.
+enum class IterationPolicy
+{
+	Bitmap,
+	Archetype
+};
+
+class ArchetypeTableImpl;
+using ArchetypeTable = shared_ptr<ArchetypeTableImpl>;
+
+/**
+ * @brief The entities that share a signature, with the addresses of their components, in chunks of ENTIDY_ARCHETYPE_CHUNK_SIZE rows.
+ * Chunks are stored column by column: the entity handles first, followed by the addresses of every component of
+ * the signature, in the order of the signature. Rows are kept dense; removing a row moves the last row into its place.
+ */
+class ArchetypeTableImpl
+{
+protected:
+	size_t width;
+	size_t size = 0;
+	pmr::memory_resource* resource;
+	pmr::vector<intptr_t*> chunks;
+
+	/**
+     * @brief Returns the size of a chunk, in bytes.
+     */
+	size_t ChunkBytes() const
+	{
+		return width * ENTIDY_ARCHETYPE_CHUNK_SIZE * sizeof(intptr_t);
+	}
+
+public:
+	/**
+     * @brief Creates an empty table.
+     * @param columns The number of columns, including the column of entity handles.
+     * @param memory The memory resource that allocates the chunks, which must outlive the table.
+     */
+	ArchetypeTableImpl(size_t columns, pmr::memory_resource* memory)
+		: width(columns)
+		, resource(memory)
+		, chunks(memory)
+	{ }
+
+	ArchetypeTableImpl(const ArchetypeTableImpl&) = delete;
+	ArchetypeTableImpl& operator=(const ArchetypeTableImpl&) = delete;
+
+	/**
+     * @brief De-allocates all the chunks.
+     */
+	~ArchetypeTableImpl()
+	{
+		for(intptr_t* chunk : chunks)
+			resource->deallocate(chunk, ChunkBytes(), alignof(intptr_t));
+	}
+
+	/**
+     * @brief Returns the number of rows in the table.
+     */
+	size_t Size() const
+	{
+		return size;
+	}
+
+	/**
+     * @brief Returns the number of columns in the table, including the column of entity handles.
+     */
+	size_t Width() const
+	{
+		return width;
+	}
+
+	/**
+     * @brief Returns the number of chunks in the table. All the chunks are full, except the last one.
+     */
+	size_t Chunks() const
+	{
+		return chunks.size();
+	}
+
+	/**
+     * @brief Returns the size of the chunks of the table, in bytes.
+     */
+	size_t Bytes() const
+	{
+		return chunks.size() * ChunkBytes();
+	}
+
+	/**
+     * @brief Returns the cells of a chunk. Column 'k' of the chunk starts at k * ENTIDY_ARCHETYPE_CHUNK_SIZE.
+     */
+	const intptr_t* Chunk(size_t chunk) const
+	{
+		return chunks[chunk];
+	}
+
+	/**
+     * @brief Returns a reference to the cell at 'row' and 'column'.
+     */
+	intptr_t& Cell(size_t row, size_t column)
+	{
+		return chunks[row / ENTIDY_ARCHETYPE_CHUNK_SIZE][column * ENTIDY_ARCHETYPE_CHUNK_SIZE + row % ENTIDY_ARCHETYPE_CHUNK_SIZE];
+	}
+
+	/**
+     * @brief Adds a row at the end of the table, allocating a new chunk if the last one is full.
+     * @return The index of the new row, whose cells are uninitialized.
+     */
+	size_t Append()
+	{
+		if(size == chunks.size() * ENTIDY_ARCHETYPE_CHUNK_SIZE)
+			chunks.push_back(static_cast<intptr_t*>(resource->allocate(ChunkBytes(), alignof(intptr_t))));
+		return size++;
+	}
+
+	/**
+     * @brief Removes a row by moving the last row into its place. Chunks that become empty are deallocated.
+     * @param row The index of the row to remove.
+     * @return The entity handle of the row that was moved into 'row', or 0 if 'row' was the last row.
+     */
+	Entity Remove(size_t row)
+	{
+		size_t last = --size;
+		Entity moved = 0;
+		if(row != last)
+		{
+			for(size_t k = 0; k < width; k++)
+				Cell(row, k) = Cell(last, k);
+			moved = Entity(Cell(row, 0));
+		}
+
+		if(size <= (chunks.size() - 1) * ENTIDY_ARCHETYPE_CHUNK_SIZE)
+		{
+			resource->deallocate(chunks.back(), ChunkBytes(), alignof(intptr_t));
+			chunks.pop_back();
+		}
+		return moved;
+	}
+};
+
+// A table matched by a compiled query, with the columns of the selected components in the order of the selection.
+struct ArchetypeSlice
+{
+	ArchetypeTable table;
+	vector<size_t> columns;
+};
+
+} // namespace entidy
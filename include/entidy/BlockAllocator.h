@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+#ifndef ENTIDY_BLOCK_MMAP
+#	if defined(__linux__)
+#		define ENTIDY_BLOCK_MMAP 1
+#	else
+#		define ENTIDY_BLOCK_MMAP 0
+#	endif
+#endif
+
+#if ENTIDY_BLOCK_MMAP
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+// Size of the huge pages that back memory blocks with AllocationPolicy::HugePages
+#ifndef ENTIDY_HUGE_PAGE_SIZE
+#	define ENTIDY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+static_assert((ENTIDY_HUGE_PAGE_SIZE & (ENTIDY_HUGE_PAGE_SIZE - 1)) == 0, "ENTIDY_HUGE_PAGE_SIZE must be a power of two");
+
+// Maximum number of memory blocks allocated at once from a memory resource
+#ifndef ENTIDY_BLOCK_BATCH
+#	define ENTIDY_BLOCK_BATCH 8
+#endif
+
+namespace entidy
+{
+using namespace std;
+
+// Heap: memory blocks are allocated from the memory resource of the registry; operator new by default.
+// HugePages: memory blocks span at least ENTIDY_HUGE_PAGE_SIZE bytes, and are mapped with explicit huge pages when the system
+// has some reserved, or with transparent huge pages otherwise. Falls back to Heap where memory cannot be mapped.
+// Mapped blocks bypass the memory resource.
+enum class AllocationPolicy
+{
+	Heap,
+	HugePages
+};
+
+// NUMA nodes for memory blocks: AnyNode leaves their placement to the system, LocalNode prefers the node of the thread
+// that allocates them. Other values prefer the node with that number.
+constexpr int AnyNode = -1;
+constexpr int LocalNode = -2;
+
+/**
+ * @brief Allocates the storage of the memory blocks of a pool, aligned to its own size.
+ * Storage that is placed on a NUMA node or backed by huge pages is mapped directly from the system, where supported;
+ * failures to map it, to get huge pages or to bind it to a node are not errors, and fall back to the memory resource.
+ * Other storage is carved out of batches of blocks allocated from the memory resource of the registry, each aligned to
+ * the block size. Resources that pad allocations to align them, such as monotonic buffers, then waste at most one block
+ * per batch instead of up to one block per block. Batches hold half as many blocks as are already in use, up to
+ * ENTIDY_BLOCK_BATCH, so the storage of a pool grows by at most half at once; a batch is released once none of its
+ * blocks is used.
+ */
+class BlockAllocator
+{
+protected:
+	struct Batch
+	{
+		char* data;
+		size_t count;
+		size_t used;
+	};
+
+	pmr::memory_resource* resource;
+	pmr::vector<Batch> batches;
+	// Storage carved out of the batches that no block uses
+	pmr::vector<void*> spare;
+	size_t size;
+	size_t in_use = 0;
+
+	/**
+     * @brief Returns the batch that holds carved storage.
+     */
+	Batch& Find(void* region)
+	{
+		char* address = static_cast<char*>(region);
+		for(Batch& batch : batches)
+			if(address >= batch.data && address < batch.data + batch.count * size)
+				return batch;
+		return batches.back();
+	}
+
+	/**
+     * @brief Returns spare storage, allocating a new batch from the memory resource if there is none.
+     */
+	void* Carve()
+	{
+		if(spare.empty())
+		{
+			size_t count = min(max(in_use / 2, size_t(1)), size_t(ENTIDY_BLOCK_BATCH));
+			// Every carved block can be returned to the spare storage without allocating
+			size_t carved = count;
+			for(const Batch& batch : batches)
+				carved += batch.count;
+			batches.reserve(batches.size() + 1);
+			spare.reserve(carved);
+			char* data = static_cast<char*>(resource->allocate(count * size, size));
+			batches.push_back(Batch{data, count, 0});
+			for(size_t i = count; i-- > 0;)
+				spare.push_back(data + i * size);
+		}
+
+		void* region = spare.back();
+		spare.pop_back();
+		Find(region).used++;
+		return region;
+	}
+
+	/**
+     * @brief Returns carved storage to the spare storage, and releases its batch if none of its blocks is used anymore.
+     */
+	void Uncarve(void* region)
+	{
+		Batch& batch = Find(region);
+		spare.push_back(region);
+		if(--batch.used > 0)
+			return;
+
+		char* begin = batch.data;
+		char* end = begin + batch.count * size;
+		spare.erase(remove_if(spare.begin(), spare.end(), [begin, end](void* storage) {
+			return static_cast<char*>(storage) >= begin && static_cast<char*>(storage) < end;
+		}), spare.end());
+		resource->deallocate(begin, batch.count * size, size);
+		batch = batches.back();
+		batches.pop_back();
+	}
+
+#if ENTIDY_BLOCK_MMAP
+	/**
+     * @brief Maps 'size' bytes aligned to 'size', by mapping twice as much and unmapping the excess.
+     * @return The mapped storage, or nullptr if it cannot be mapped.
+     */
+	static void* Map(size_t size, int flags)
+	{
+		void* raw = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+		if(raw == MAP_FAILED)
+			return nullptr;
+		if((uintptr_t(raw) & (size - 1)) == 0)
+			return raw;
+
+		munmap(raw, size);
+		raw = mmap(nullptr, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+		if(raw == MAP_FAILED)
+			return nullptr;
+
+		uintptr_t start = (uintptr_t(raw) + size - 1) & ~uintptr_t(size - 1);
+		size_t head = size_t(start - uintptr_t(raw));
+		if(head > 0)
+			munmap(raw, head);
+		if(size - head > 0)
+			munmap(reinterpret_cast<char*>(start) + size, size - head);
+		return reinterpret_cast<void*>(start);
+	}
+
+	/**
+     * @brief Sets the preferred NUMA node of mapped storage, before any of its pages is touched.
+     */
+	static void Bind(void* region, size_t size, int node)
+	{
+#	if defined(SYS_mbind) && defined(SYS_getcpu)
+		if(node == LocalNode)
+		{
+			unsigned cpu = 0, local = 0;
+			if(syscall(SYS_getcpu, &cpu, &local, nullptr) != 0)
+				return;
+			node = int(local);
+		}
+
+		constexpr size_t bits = 8 * sizeof(unsigned long);
+		unsigned long mask[1024 / bits] = {};
+		if(node < 0 || size_t(node) >= 1024)
+			return;
+		mask[size_t(node) / bits] |= 1UL << (size_t(node) % bits);
+
+		// MPOL_PREFERRED: pages go to the node while it has free memory, and elsewhere otherwise
+		syscall(SYS_mbind, region, size, 1, mask, 1024 + 1, 0);
+#	endif
+	}
+#endif
+
+public:
+	/**
+     * @param block_size The size and alignment of the storage of a block, a power of two.
+     * @param memory The memory resource that allocates the batches, which must outlive the allocator.
+     */
+	BlockAllocator(size_t block_size, pmr::memory_resource* memory)
+		: resource{memory}
+		, batches(memory)
+		, spare(memory)
+		, size{block_size}
+	{ }
+
+	BlockAllocator(const BlockAllocator&) = delete;
+	BlockAllocator& operator=(const BlockAllocator&) = delete;
+
+	/**
+     * @brief Releases the batches. The storage of the blocks must not be used anymore.
+     */
+	~BlockAllocator()
+	{
+		for(Batch& batch : batches)
+			resource->deallocate(batch.data, batch.count * size, size);
+	}
+
+	/**
+     * @brief Returns the size of the storage of a block.
+     */
+	size_t Size() const
+	{
+		return size;
+	}
+
+	/**
+     * @brief Changes the size of the storage of the blocks; only valid while no storage is allocated.
+     */
+	void Resize(size_t block_size)
+	{
+		size = block_size;
+	}
+
+	/**
+     * @brief Returns the number of blocks that were carved out of batches, and are not used yet.
+     */
+	size_t Spare() const
+	{
+		return spare.size();
+	}
+
+	/**
+     * @brief Allocates the storage of a block, aligned to its size.
+     * @param policy How to allocate the storage.
+     * @param node The NUMA node of the storage: AnyNode, LocalNode or the number of a node.
+     * @param mapped Set to whether the storage was mapped from the system, to be passed to Free.
+     * @return The storage.
+     */
+	void* Allocate(AllocationPolicy policy, int node, bool& mapped)
+	{
+		mapped = false;
+#if ENTIDY_BLOCK_MMAP
+		if(policy == AllocationPolicy::HugePages || node != AnyNode)
+		{
+			void* region = nullptr;
+			bool huge = policy == AllocationPolicy::HugePages && size % ENTIDY_HUGE_PAGE_SIZE == 0;
+#	ifdef MAP_HUGETLB
+			if(huge)
+				region = Map(size, MAP_HUGETLB);
+#	endif
+			if(region == nullptr)
+			{
+				region = Map(size, 0);
+#	ifdef MADV_HUGEPAGE
+				if(region != nullptr && huge)
+					madvise(region, size, MADV_HUGEPAGE);
+#	endif
+			}
+
+			if(region != nullptr)
+			{
+				if(node != AnyNode)
+					Bind(region, size, node);
+				mapped = true;
+				in_use++;
+				return region;
+			}
+		}
+#endif
+		void* region = Carve();
+		in_use++;
+		return region;
+	}
+
+	/**
+     * @brief Releases storage returned by Allocate.
+     */
+	void Free(void* region, bool mapped)
+	{
+		in_use--;
+#if ENTIDY_BLOCK_MMAP
+		if(mapped)
+		{
+			munmap(region, size);
+			return;
+		}
+#endif
+		Uncarve(region);
+	}
+};
+
+} // namespace entidy
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include <entidy/CRoaring/roaring.hh>
+#include <entidy/Entity.h>
+#include <entidy/ThreadPool.h>
+
+namespace entidy
+{
+using namespace std;
+
+using BitMap = Roaring;
+
+class ChangeTrackerImpl;
+using ChangeTracker = shared_ptr<ChangeTrackerImpl>;
+
+/**
+ * @brief The entities whose instances of a component were changed, during the current and the previous epoch.
+ * Epochs are counted by the registry, which starts a new one at every commit. Trackers are not cleared when an epoch
+ * ends: they catch up the next time they are used, so starting an epoch costs nothing however many components are tracked.
+ * Changes can be marked concurrently from multiple threads.
+ */
+class ChangeTrackerImpl
+{
+protected:
+	SpinLock lock;
+	BitMap current;
+	BitMap previous;
+	size_t epoch;
+
+	/**
+     * @brief Moves on to epoch 'now': the changes of the current epoch become the previous changes if 'now' follows it,
+     * and are discarded otherwise. The lock must be held.
+     */
+	void Rotate(size_t now)
+	{
+		if(epoch == now)
+			return;
+
+		previous = epoch + 1 == now ? std::move(current) : BitMap();
+		current = BitMap();
+		epoch = now;
+	}
+
+public:
+	/**
+     * @brief Creates a tracker with no changes.
+     * @param now The current epoch.
+     */
+	explicit ChangeTrackerImpl(size_t now)
+		: epoch(now)
+	{ }
+
+	/**
+     * @brief Marks an entity as changed during epoch 'now'.
+     * @param now The current epoch.
+     * @param entity The index of the entity.
+     */
+	void Mark(size_t now, Entity entity)
+	{
+		lock_guard<SpinLock> guard(lock);
+		Rotate(now);
+		current.add(entity);
+	}
+
+	/**
+     * @brief Marks a list of entities as changed during epoch 'now'.
+     * @param now The current epoch.
+     * @param count The number of entities.
+     * @param entities The indices of the entities.
+     */
+	void Mark(size_t now, size_t count, const Entity* entities)
+	{
+		lock_guard<SpinLock> guard(lock);
+		Rotate(now);
+		current.addMany(count, entities);
+	}
+
+	/**
+     * @brief Marks a set of entities as changed during epoch 'now'.
+     * @param now The current epoch.
+     * @param entities The indices of the entities.
+     */
+	void Mark(size_t now, const BitMap& entities)
+	{
+		lock_guard<SpinLock> guard(lock);
+		Rotate(now);
+		current |= entities;
+	}
+
+	/**
+     * @brief Returns the entities that were changed during the epoch before 'now', among 'entities'.
+     * @param now The current epoch.
+     * @param entities The entities that have the component.
+     * @return The changed entities.
+     */
+	BitMap Changed(size_t now, const BitMap& entities)
+	{
+		lock_guard<SpinLock> guard(lock);
+		Rotate(now);
+		return previous & entities;
+	}
+
+	/**
+     * @brief Returns all the entities that were marked during the epoch before 'now'.
+     * @param now The current epoch.
+     * @return The marked entities.
+     */
+	BitMap Previous(size_t now)
+	{
+		lock_guard<SpinLock> guard(lock);
+		Rotate(now);
+		return previous;
+	}
+
+	/**
+     * @brief Returns the number of entities that were changed during the epoch before 'now', including the entities
+     * that lost the component since.
+     * @param now The current epoch.
+     * @return The number of changed entities.
+     */
+	uint64_t Count(size_t now)
+	{
+		lock_guard<SpinLock> guard(lock);
+		Rotate(now);
+		return previous.cardinality();
+	}
+};
+
+} // namespace entidy
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <entidy/Entity.h>
+
+#ifndef ENTIDY_COMMAND_CHUNK_SIZE
+#	define ENTIDY_COMMAND_CHUNK_SIZE 65536
+#endif
+
+namespace entidy
+{
+using namespace std;
+
+enum class CommandType : uint8_t
+{
+	Emplace,
+	Erase,
+	Remove
+};
+
+/**
+ * @brief A deferred mutation of the registry.
+ * Emplace commands are followed, in the same buffer, by the component instance to be moved into the registry.
+ */
+struct Command
+{
+	CommandType type;
+	Entity entity;
+	size_t component;
+	uint32_t size;
+	uint32_t payload;
+	void (*move)(void* dst, void* src);
+	void (*destroy)(void* src);
+
+	/**
+     * @brief Returns a pointer to the component instance carried by an Emplace command.
+     * @return A pointer to the instance, or nullptr for commands without instances (e.g typeless components).
+     */
+	void* Payload()
+	{
+		return payload == 0 ? nullptr : reinterpret_cast<char*>(this) + payload;
+	}
+};
+
+class CommandBufferImpl;
+using CommandBuffer = shared_ptr<CommandBufferImpl>;
+
+class CommandBufferImpl
+{
+protected:
+	struct Chunk
+	{
+		char* data;
+		size_t capacity;
+		size_t used;
+	};
+
+	pmr::memory_resource* resource;
+	vector<Chunk> chunks;
+	size_t current = 0;
+	size_t count = 0;
+
+	/**
+     * @brief Moves an instance of Type from 'src' into the uninitialized memory at 'dst', and destroys 'src'.
+     */
+	template <typename Type>
+	static void Move(void* dst, void* src)
+	{
+		new(dst) Type(std::move(*static_cast<Type*>(src)));
+		static_cast<Type*>(src)->~Type();
+	}
+
+	/**
+     * @brief Constructs an instance of Type at 'dst' from the arguments stored in the tuple at 'src', and destroys the tuple.
+     */
+	template <typename Type, typename Tuple>
+	static void Construct(void* dst, void* src)
+	{
+		Tuple* arguments = static_cast<Tuple*>(src);
+		std::apply([dst](auto&... args) { new(dst) Type(std::move(args)...); }, *arguments);
+		arguments->~Tuple();
+	}
+
+	/**
+     * @brief Destroys the instance of Type at 'src'.
+     */
+	template <typename Type>
+	static void Destroy(void* src)
+	{
+		static_cast<Type*>(src)->~Type();
+	}
+
+	/**
+     * @brief Reserves a record of 'size' bytes in the current chunk, moving on to a reused or new chunk if it does not fit.
+     * Chunks are never reallocated, so records and their instances never move until the buffer is reset.
+     * @param size The size of the record, including the worst-case padding of its instance.
+     * @return A pointer to the record, aligned for Command.
+     */
+	Command* Allocate(size_t size)
+	{
+		size = (size + alignof(Command) - 1) / alignof(Command) * alignof(Command);
+
+		while(current < chunks.size() && chunks[current].used + size > chunks[current].capacity)
+			current++;
+
+		if(current == chunks.size())
+		{
+			size_t capacity = max(size_t(ENTIDY_COMMAND_CHUNK_SIZE), size);
+			char* data = static_cast<char*>(resource->allocate(capacity, alignof(Command)));
+			chunks.push_back(Chunk{data, capacity, 0});
+		}
+
+		Chunk& chunk = chunks[current];
+		Command* cmd = reinterpret_cast<Command*>(chunk.data + chunk.used);
+		chunk.used += size;
+		count++;
+
+		cmd->size = uint32_t(size);
+		cmd->payload = 0;
+		cmd->move = nullptr;
+		cmd->destroy = nullptr;
+		return cmd;
+	}
+
+	/**
+     * @brief Reserves an Emplace command followed by a suitably aligned instance of Payload, constructed from 'args'.
+     * @tparam Payload The type of the instance stored in the buffer.
+     * @return A pointer to the command.
+     */
+	template <typename Payload, typename... Args>
+	Command* Record(Entity entity, size_t component, Args&&... args)
+	{
+		Command* cmd = Allocate(sizeof(Command) + alignof(Payload) - 1 + sizeof(Payload));
+		cmd->type = CommandType::Emplace;
+		cmd->entity = entity;
+		cmd->component = component;
+
+		uintptr_t address = reinterpret_cast<uintptr_t>(cmd) + sizeof(Command);
+		address = (address + alignof(Payload) - 1) / alignof(Payload) * alignof(Payload);
+		cmd->payload = uint32_t(address - reinterpret_cast<uintptr_t>(cmd));
+
+		new(cmd->Payload()) Payload(std::forward<Args>(args)...);
+		return cmd;
+	}
+
+public:
+	/**
+     * @param memory The memory resource that allocates the chunks, which must outlive the buffer; the default resource if null.
+     */
+	explicit CommandBufferImpl(pmr::memory_resource* memory = nullptr)
+		: resource(memory != nullptr ? memory : pmr::get_default_resource())
+	{ }
+
+	CommandBufferImpl(const CommandBufferImpl&) = delete;
+	CommandBufferImpl& operator=(const CommandBufferImpl&) = delete;
+
+	/**
+     * @brief Destroys the instances of the commands that were not applied, and deallocates all the chunks.
+     */
+	~CommandBufferImpl()
+	{
+		Reset();
+		for(auto& chunk : chunks)
+			resource->deallocate(chunk.data, chunk.capacity, alignof(Command));
+	}
+
+	/**
+     * @brief Records the creation of a component, constructing the instance in the buffer.
+     * Types that are not move-constructible are constructed when the command is applied, from a copy of the arguments.
+     * @tparam Type The component type.
+     * @param entity The entity.
+     * @param component The index of the component.
+     * @param args... The arguments to forward to Type's constructor.
+     */
+	template <typename Type, typename... Args>
+	void Emplace(Entity entity, size_t component, Args&&... args)
+	{
+		if constexpr(is_move_constructible_v<Type>)
+		{
+			Command* cmd = Record<Type>(entity, component, std::forward<Args>(args)...);
+			cmd->move = &Move<Type>;
+			cmd->destroy = &Destroy<Type>;
+		}
+		else
+		{
+			using Tuple = tuple<decay_t<Args>...>;
+			Command* cmd = Record<Tuple>(entity, component, std::forward<Args>(args)...);
+			cmd->move = &Construct<Type, Tuple>;
+			cmd->destroy = &Destroy<Tuple>;
+		}
+	}
+
+	/**
+     * @brief Records the creation of a typeless void component (used as a flag).
+     * @param entity The entity.
+     * @param component The index of the component.
+     */
+	void Emplace(Entity entity, size_t component)
+	{
+		Command* cmd = Allocate(sizeof(Command));
+		cmd->type = CommandType::Emplace;
+		cmd->entity = entity;
+		cmd->component = component;
+	}
+
+	/**
+     * @brief Records the deletion of a component.
+     * @param entity The entity.
+     * @param component The index of the component.
+     */
+	void Erase(Entity entity, size_t component)
+	{
+		Command* cmd = Allocate(sizeof(Command));
+		cmd->type = CommandType::Erase;
+		cmd->entity = entity;
+		cmd->component = component;
+	}
+
+	/**
+     * @brief Records the removal of an entity and all its components.
+     * @param entity The entity.
+     */
+	void Remove(Entity entity)
+	{
+		Command* cmd = Allocate(sizeof(Command));
+		cmd->type = CommandType::Remove;
+		cmd->entity = entity;
+		cmd->component = 0;
+	}
+
+	/**
+     * @brief Calls 'fn' on every recorded command, in the order they were recorded.
+     * @param fn Any functor or lambda that expects a Command&.
+     */
+	template <typename F>
+	void Each(F&& fn)
+	{
+		for(size_t c = 0; c < chunks.size() && c <= current; c++)
+		{
+			size_t offset = 0;
+			while(offset < chunks[c].used)
+			{
+				Command* cmd = reinterpret_cast<Command*>(chunks[c].data + offset);
+				offset += cmd->size;
+				fn(*cmd);
+			}
+		}
+	}
+
+	/**
+     * @brief Destroys the instances still held by the buffer and empties it, keeping its chunks for reuse.
+     * Commands whose instance was moved out must have their 'destroy' function cleared.
+     */
+	void Reset()
+	{
+		if(count == 0)
+			return;
+
+		Each([](Command& cmd) {
+			if(cmd.destroy != nullptr)
+				cmd.destroy(cmd.Payload());
+		});
+
+		for(auto& chunk : chunks)
+			chunk.used = 0;
+		current = 0;
+		count = 0;
+	}
+
+	/**
+     * @brief Returns the number of recorded commands.
+     * @return The number of commands.
+     */
+	size_t Size() const
+	{
+		return count;
+	}
+
+	/**
+     * @brief Returns the number of bytes reserved by the buffer.
+     * @return The capacity in bytes.
+     */
+	size_t Capacity() const
+	{
+		size_t bytes = 0;
+		for(auto& chunk : chunks)
+			bytes += chunk.capacity;
+		return bytes;
+	}
+};
+
+} // namespace entidy
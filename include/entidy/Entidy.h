@@ -1,41 +1,71 @@
 #pragma once
 
 #include <deque>
+#include <functional>
 #include <memory>
+#include <memory_resource>
 #include <string>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 
+#include <entidy/Archetype.h>
+#include <entidy/CommandBuffer.h>
+#include <entidy/Entity.h>
 #include <entidy/Exception.h>
 #include <entidy/Indexer.h>
 #include <entidy/Query.h>
+#include <entidy/ThreadPool.h>
 #include <entidy/View.h>
 
 namespace entidy
 {
 using namespace std;
 
-using Entity = uint32_t;
-
 class Entidy
 {
 protected:
 	Indexer indexer;
-	vector<std::function<void()>> ddl;
+	CommandBuffer commands;
+	bool cleanup = false;
+	bool compaction = false;
+	SpinLock recording;
 
 public:
-	Entidy()
-		: indexer{make_shared<IndexerImpl>()}
+	/**
+     * @brief Creates an empty registry.
+     * @param resource The memory resource that allocates the memory blocks of the components, the pages of the sparse vectors,
+     * the archetype tables and the command buffer; the default resource (operator new) if null. It must outlive the
+     * registry, and the views and handles obtained from it. With a monotonic resource, memory is only released with the
+     * resource, e.g. when a whole zone is torn down. Memory blocks are aligned to their size, which a monotonic resource
+     * pads: size it with headroom over the total reported by MemoryStats.
+     * @example
+     * std::pmr::monotonic_buffer_resource arena(256 << 20);
+     * {
+     *     Entidy zone(&arena);
+     *     ...
+     * }
+     * arena.release();
+     */
+	explicit Entidy(pmr::memory_resource* resource = nullptr)
+		: indexer{make_shared<IndexerImpl>(resource)}
+		, commands{make_shared<CommandBufferImpl>(resource)}
 	{ }
 
 	~Entidy() { }
 
 	/**
      * @brief Returns a new or recycled entity.
+     * Recycled entities get a new generation, so handles to the entity that was removed remain stale.
+     * This function can be called concurrently with itself and with the functions that record changes (Emplace, Erase, CleanUp).
+     * It adds the entity to the set of alive entities right away, so it must NOT run concurrently with the functions that read
+     * that set: Alive, Has, Component, and queries whose filter contains '!'.
      * @return Entity.
+     * @throw EntidyException if all the entity indices are in use.
      */
 	Entity Create()
 	{
+		lock_guard<SpinLock> guard(recording);
 		return indexer->AddEntity();
 	}
 
@@ -43,7 +73,9 @@ public:
      * @brief Creates, indexes and returns a memory-managed instance of component.
      * The new instance is allocated or recycled by the memory pool.
      * If the component key does not exist, it is created and a Type association is saved.
-     * This action is executed during commit.
+     * The instance is constructed in the command buffer right away, and moved into the registry during commit.
+     * Changes can be recorded concurrently from multiple threads, once the key exists with its type (see Register and Declare):
+     * the first Emplace of a key with a type associates the type and creates the memory pool of the component.
      * @tparam Type The component type.
      * @param entity The entity.
      * @param key The key for for the component to add.
@@ -51,12 +83,11 @@ public:
      * @throw EntidyException if the key had been previously used for a different type.
      */
 	template <typename Type, typename... Args>
-	void Emplace(Entity entity, const string& key, Args... args)
+	void Emplace(Entity entity, const string& key, Args&&... args)
 	{
-		ddl.push_back([this, entity, key, args...]() {
-			Type* c = indexer->CreateComponent<Type>(entity, key);
-			new(c) Type(args...);
-		});
+		lock_guard<SpinLock> guard(recording);
+		ComponentId<Type> id = indexer->LookupComponent<Type>(key);
+		commands->Emplace<Type>(entity, id.Index(), std::forward<Args>(args)...);
 	}
 
 	/**
@@ -64,7 +95,8 @@ public:
      * The new instance is allocated or recycled by the memory pool.
      * If the component key does not exist, it is created and a Type association is saved.
      * The provided component will be copied into the newly created component.
-     * This action is executed during commit.
+     * This action is executed during commit, and can be recorded concurrently from multiple threads once the key exists
+     * with its type (see Register and Declare).
      * WARNING: The provided component must be copy-constructible. 
      * @tparam Type The component type.
      * @param entity The entity.
@@ -75,49 +107,151 @@ public:
 	template <typename Type>
 	void Emplace(Entity entity, const string& key, const Type& component)
 	{
-		ddl.push_back([=]() {
-			Type* c = indexer->CreateComponent<Type>(entity, key);
-			new(c) Type(component);
-		});
+		lock_guard<SpinLock> guard(recording);
+		ComponentId<Type> id = indexer->LookupComponent<Type>(key);
+		commands->Emplace<Type>(entity, id.Index(), component);
+	}
+
+	/**
+     * @brief Creates, indexes and returns a memory-managed instance of a registered component.
+     * No key lookups or type checks are performed.
+     * The instance is constructed in the command buffer right away, and moved into the registry during commit.
+     * Changes can be recorded concurrently from multiple threads.
+     * @tparam Type The component type.
+     * @param entity The entity.
+     * @param id The handle of the component to add, returned by Register.
+     * @param args... The arguments to forward to Type's constructor.
+     */
+	template <typename Type, typename... Args>
+	void Emplace(Entity entity, ComponentId<Type> id, Args&&... args)
+	{
+		lock_guard<SpinLock> guard(recording);
+		commands->Emplace<Type>(entity, id.Index(), std::forward<Args>(args)...);
+	}
+
+	/**
+     * @brief Creates, indexes and returns a memory-managed instance of a registered component.
+     * The provided component will be copied into the newly created component.
+     * No key lookups or type checks are performed.
+     * This action is executed during commit, and can be recorded concurrently from multiple threads.
+     * WARNING: The provided component must be copy-constructible.
+     * @tparam Type The component type.
+     * @param entity The entity.
+     * @param id The handle of the component to add, returned by Register.
+     * @param component The component that will be copied into the newly created component.
+     */
+	template <typename Type>
+	void Emplace(Entity entity, ComponentId<Type> id, const Type& component)
+	{
+		lock_guard<SpinLock> guard(recording);
+		commands->Emplace<Type>(entity, id.Index(), component);
+	}
+
+	/**
+     * @brief Indexes a registered typeless void component (used as a flag).
+     * This action is executed during commit, and can be recorded concurrently from multiple threads.
+     * @param entity The entity.
+     * @param id The handle of the component to add, returned by Register.
+     */
+	void Emplace(Entity entity, ComponentId<void> id)
+	{
+		lock_guard<SpinLock> guard(recording);
+		commands->Emplace(entity, id.Index());
 	}
 
 	/**
      * @brief Creates and indexes a typeless void component (used as a flag).
      * If the component key does not exist, it is created.
      * No memory pool is created.
-     * This action is executed during commit.
+     * This action is executed during commit, and can be recorded concurrently from multiple threads once the key exists
+     * (see Declare).
      * @param entity The entity.
      * @param key The key for for the component to add.
      * @throw EntidyException if the key had been previously used for a different type.
      */
 	void Emplace(Entity entity, const string& key)
 	{
-		ddl.push_back([=]() {
-			indexer->CreateVoidComponent(entity, key);
-		});
+		lock_guard<SpinLock> guard(recording);
+		commands->Emplace(entity, indexer->LookupComponent(key).Index());
 	}
 
 	/**
      * @brief Removes an entity and deletes all its components.
      * Sends all the deleted components to the memory-manager for recycling.
-     * This action is executed during commit.
+     * This action is executed during commit, and can be recorded concurrently from multiple threads.
+     * Changes recorded for the entity after its removal, and removals of stale handles, are ignored.
      * @param entity The entity to remove.
      */
 	void Erase(Entity entity)
 	{
-		ddl.push_back([=]() { indexer->RemoveEntity(entity); });
+		lock_guard<SpinLock> guard(recording);
+		commands->Remove(entity);
+	}
+
+	/**
+     * @brief Removes a list of entities and deletes all their components.
+     * The removals are applied together during commit, with a single bulk removal per component bitmap,
+     * and only the components that the entities have are visited.
+     * This action can be recorded concurrently from multiple threads.
+     * @param entities The entities to remove.
+     */
+	void Erase(const vector<Entity>& entities)
+	{
+		lock_guard<SpinLock> guard(recording);
+		for(Entity entity : entities)
+			commands->Remove(entity);
+	}
+
+	/**
+     * @brief Removes every entity in a view and deletes all their components.
+     * The removals are applied together during commit, with a single bulk removal per component bitmap,
+     * and only the components that the entities have are visited.
+     * The view must have been fetched since the last commit.
+     * This action can be recorded concurrently from multiple threads.
+     * @param view The view over the entities to remove.
+     */
+	void Erase(const View& view)
+	{
+		lock_guard<SpinLock> guard(recording);
+		view.Each([this](Entity entity) { commands->Remove(entity); });
 	}
 
 	/**
      * @brief Deletes component with key 'key' for entity 'entity'.
      * Also sends the instance back to the memory-manager for recycling.
-     * This action is executed during commit.
+     * This action is executed during commit, and can be recorded concurrently from multiple threads.
      * @param entity The entity.
      * @param key The key for for the component to delete.
      */
 	void Erase(Entity entity, const string& key)
 	{
-		ddl.push_back([=]() { return indexer->DeleteComponent(entity, key); });
+		lock_guard<SpinLock> guard(recording);
+		commands->Erase(entity, indexer->ComponentIndex(key));
+	}
+
+	/**
+     * @brief Deletes a registered component for entity 'entity'.
+     * Also sends the instance back to the memory-manager for recycling.
+     * This action is executed during commit, and can be recorded concurrently from multiple threads.
+     * @param entity The entity.
+     * @param id The handle of the component to delete, returned by Register.
+     */
+	template <typename Type>
+	void Erase(Entity entity, ComponentId<Type> id)
+	{
+		lock_guard<SpinLock> guard(recording);
+		commands->Erase(entity, id.Index());
+	}
+
+	/**
+     * @brief Checks in constant time whether a handle refers to an entity that was created and not removed since.
+     * Handles of removed entities remain stale after their index is recycled, so they can be safely kept across frames.
+     * @param entity The entity.
+     * @return true if the entity is alive, false if the handle is stale.
+     */
+	bool Alive(Entity entity) const
+	{
+		return indexer->Alive(entity);
 	}
 
 	/**
@@ -131,6 +265,58 @@ public:
 		return indexer->HasComponent(entity, key);
 	}
 
+	/**
+     * @brief Checks if Entity 'entity' has a registered component.
+     * @param entity The entity.
+     * @param id The handle of the component to check, returned by Register.
+     * @return false if component was not found, true otherwise.
+     */
+	template <typename Type>
+	bool Has(Entity entity, ComponentId<Type> id)
+	{
+		return indexer->HasComponent(entity, id.Index());
+	}
+
+	/**
+     * @brief Resolves component 'key' and associates it with Type, returning a handle to access it without key lookups.
+     * Registered components are never recycled by CleanUp, so handles remain valid for the lifetime of the registry.
+     * @tparam Type The component type, or void for typeless (flag) components.
+     * @param key The key for the component.
+     * @return A handle to the component.
+     * @throw EntidyException if the key had been previously used for a different type.
+     * @example
+     * auto position = registry.Register<Vec2f>("Position");
+     * registry.Emplace(e, position, 1.0, 2.0);
+     * Vec2f* p = registry.Component(e, position);
+     */
+	template <typename Type = void>
+	ComponentId<Type> Register(const string& key)
+	{
+		if constexpr(is_void_v<Type>)
+			return indexer->RegisterComponent(key);
+		else
+			return indexer->RegisterComponent<Type>(key);
+	}
+
+	/**
+     * @brief Creates the components for the given keys if they do not exist yet, without associating them with a type.
+     * Creating a component modifies the registry, but looking up an existing key does not: once their keys are declared,
+     * components can be selected and changes recorded from multiple threads at once, as long as no thread uses an
+     * undeclared key, with two exceptions:
+     * - The first Emplace of a key with a type associates the type and creates the memory pool of the component,
+     *   and must not run concurrently with any other use of the key. Register typed components before going concurrent,
+     *   or make sure that threads that emplace a key never run alongside threads that select or access it.
+     * - Create modifies the set of alive entities (see Create).
+     * Declared components that are still empty may be recycled by CleanUp; declare them again after committing.
+     * This function is NOT thread-safe.
+     * @param keys The keys of the components.
+     */
+	void Declare(const vector<string>& keys)
+	{
+		for(auto& key : keys)
+			indexer->ComponentIndex(key);
+	}
+
 	/**
      * @brief Returns a Query object that is pre-built with a list of component keys to fetch.
      * @param keys A list of keys to fetch. Empty lists are allowed.
@@ -141,10 +327,27 @@ public:
 		return Query(indexer, keys);
 	}
 
+	/**
+     * @brief Returns a query whose result is kept up to date by every commit, from the entities whose components changed,
+     * so that its cost is proportional to the changes rather than to the number of entities.
+     * The components in the filter are never recycled by CleanUp.
+     * This function is thread-safe.
+     * @param filter Query string used to filter the entities.
+     * @return An Observer for the filter, with no selected components; see Query::Observe to select components.
+     * @throw EntidyException if the filter string has a syntax error or is empty, or uses predicates such as Changed.
+     */
+	Observer Observe(const string& filter)
+	{
+		lock_guard<SpinLock> guard(recording);
+		return Select({}).Observe(filter);
+	}
+
 	/**
      * @brief Returns a pointer to the component with key 'key' for entity 'entity'.
-     * NULL values are possible if 'entity' does not have a component for 'key'
-     * @tparam Type The component type.
+     * NULL values are possible if 'entity' does not have a component for 'key', or is stale.
+     * If the component is tracked, the entity is marked as changed (see Track); marking is thread-safe.
+     * Reads that must not mark the entity ask for a const Type, e.g. Component<const Position>(entity, "position").
+     * @tparam Type The component type, const-qualified for read-only access.
      * @param entity The entity.
      * @param key The key for for the requested component.
      * @return A pointer of type 'Type' to the component at 'key'.
@@ -157,35 +360,324 @@ public:
 	}
 
 	/**
-     * @brief Sets a hint that helps the memory-manager decide on optimal sizes for its memory blocks.
-     * This should be called BEFORE the first instance of component 'key' has been emplaced.
+     * @brief Returns a pointer to a registered component for entity 'entity'.
+     * NULL values are possible if 'entity' does not have the component, or is stale.
+     * If the component is tracked, the entity is marked as changed (see Track); marking is thread-safe.
+     * Reads that must not mark the entity ask for a const Type: Component<const Position>(entity, id) converts the handle.
+     * No key lookups or type checks are performed.
+     * @tparam Type The component type, const-qualified for read-only access.
+     * @param entity The entity.
+     * @param id The handle of the requested component, returned by Register.
+     * @return A pointer of type 'Type' to the component.
+     */
+	template <typename Type>
+	Type* Component(Entity entity, ComponentId<Type> id)
+	{
+		return indexer->GetComponent<Type>(entity, id);
+	}
+
+	/**
+     * @brief Sets a hint that helps the memory-manager decide on optimal sizes for its memory blocks,
+     * and allocates memory for the expected instances in advance, so that emplacing them does not allocate.
+     * This should be called BEFORE the first instance of component 'key' has been emplaced: blocks are sized after
+     * the hint (up to 4 MB) when the type of the component is first used. Later calls only allocate more blocks.
      * There are no guarantees that the hint will be honored.
+     * This function is NOT thread-safe.
      * @param key The key for for the requested component.
      * @param size_hint A hint of the maximum number of components with key 'key' to be be expected.
+     * @example
+     * registry.SizeHint("Position", 2000000);
+     * registry.Register<Vec3>("Position");
      */
 	void SizeHint(const string& key, size_t size_hint)
 	{
-		// TODO : Size Hints
+		indexer->SetSizeHint(key, size_hint);
+	}
+
+	/**
+     * @brief Allocates memory in advance for a total of 'entity_count' entities, so that creating them does not grow
+     * the internal structures indexed by entity. Combine with SizeHint for the memory of their components.
+     * This function is NOT thread-safe.
+     * @param entity_count The number of entities to expect.
+     */
+	void Reserve(size_t entity_count)
+	{
+		indexer->Reserve(entity_count);
+	}
+
+	/**
+     * @brief Sets how the instances of component 'key' are laid out in memory.
+     * With StoragePolicy::Packed, instances are moved at the end of every commit that added or removed some of them,
+     * so that they are contiguous and ordered by entity and views iterate over them linearly.
+     * Packing costs a move per instance, and pointers to the instances are only valid until the next commit.
+     * Intended for components that are iterated far more often than they are added or removed.
+     * Types that are not move-constructible are never packed.
+     * @param key The key for for the component.
+     * @param policy The storage policy, StoragePolicy::Pooled by default.
+     */
+	void Storage(const string& key, StoragePolicy policy)
+	{
+		indexer->SetStoragePolicy(key, policy);
+	}
+
+	/**
+     * @brief Sets how the memory blocks that hold the instances of component 'key' are allocated.
+     * With AllocationPolicy::HugePages, blocks span at least one huge page (see ENTIDY_HUGE_PAGE_SIZE) and are mapped
+     * with explicit huge pages if the system has some reserved, or with transparent huge pages otherwise, which cuts
+     * TLB misses when iterating over large components. Blocks can also be placed on a NUMA node, such as the node of
+     * the thread that allocates them, which should be the thread that iterates over them.
+     * Blocks that cannot be allocated as requested are allocated as with AllocationPolicy::Heap.
+     * Should be called BEFORE the first instance of component 'key' has been emplaced; later calls only apply to new blocks.
+     * This function is NOT thread-safe.
+     * @param key The key for for the component.
+     * @param policy The allocation policy, AllocationPolicy::Heap by default.
+     * @param node The NUMA node of the blocks: AnyNode (the default), LocalNode, or the number of a node.
+     * @example
+     * registry.Allocation("Position", AllocationPolicy::HugePages, LocalNode);
+     */
+	void Allocation(const string& key, AllocationPolicy policy, int node = AnyNode)
+	{
+		indexer->SetAllocationPolicy(key, policy, node);
+	}
+
+	/**
+     * @brief Sets how compiled queries find and iterate over their entities.
+     * With IterationPolicy::Archetype, the registry also keeps the entities that have the same components together,
+     * in chunked tables that hold the addresses of their components. Compiled queries match their filter against
+     * each combination of components once, and their views scan the rows of the matching tables linearly.
+     * Keeping the tables costs extra work during commit for every entity that is created, removed or changed.
+     * Queries run with Having always evaluate bitmaps.
+     * This function is NOT thread-safe.
+     * @param policy The iteration policy, IterationPolicy::Bitmap by default.
+     */
+	void Iteration(IterationPolicy policy)
+	{
+		indexer->SetIterationPolicy(policy);
+	}
+
+	/**
+     * @brief Starts or stops tracking which entities changed their instances of component 'key'.
+     * An entity is marked as changed when the component is emplaced, accessed through Component, or visited by View::EachMut.
+     * Every commit ends an epoch: Changed(key) in a query string returns the entities marked between the last two commits,
+     * which still have the component, so that the result is the same throughout a frame.
+     * Tracked components are never recycled by CleanUp.
+     * This function is NOT thread-safe.
+     * @param key The key for the component.
+     * @param enabled true to track the component, false to stop tracking it and discard its changes.
+     * @example
+     * registry.Track("Position");
+     * auto moved = registry.Select({"Position"}).Compile("Changed(Position) & Player");
+     */
+	void Track(const string& key, bool enabled = true)
+	{
+		indexer->SetTracking(key, enabled);
+	}
+
+	/**
+     * @brief Starts or stops recording which entities gain or lose component 'key' at every commit.
+     * After a commit, Added(key) and Removed(key) in a query string return the entities that gained or lost the component
+     * during that commit; entities that both gained and lost it are in neither, and removed entities are not in Removed.
+     * Recording is done in bulk while merging the changes of the commit, and costs nothing for components that are
+     * neither watched nor subscribed to. Watched components are never recycled by CleanUp.
+     * This function is NOT thread-safe.
+     * @param key The key for the component.
+     * @param enabled true to record the events of the component, false to stop recording them once it has no subscriptions.
+     * @example
+     * registry.Watch("Sprite");
+     * auto spawned = registry.Select({"Sprite"}).Compile("Added(Sprite)");
+     */
+	void Watch(const string& key, bool enabled = true)
+	{
+		indexer->SetWatching(key, enabled);
+	}
+
+	/**
+     * @brief Subscribes to the entities that gain or lose component 'key'.
+     * After every commit, 'added' is called for each entity that gained the component during the commit, then 'removed'
+     * for each entity that lost it. Entities that were removed are passed with the handle they had before their removal.
+     * The callbacks can record changes, which are applied by the next commit.
+     * This function is NOT thread-safe.
+     * @param key The key for the component.
+     * @param added Called with every entity that gained the component; may be null.
+     * @param removed Called with every entity that lost the component; may be null.
+     * @return The subscription; the callbacks are called until the last reference to it is released.
+     * @example
+     * auto colliders = registry.Subscribe("Collider",
+     *     [&](Entity e){ tree.Insert(e); },
+     *     [&](Entity e){ tree.Erase(e); });
+     */
+	Subscription Subscribe(const string& key, function<void(Entity)> added, function<void(Entity)> removed = nullptr)
+	{
+		return indexer->Subscribe(key, std::move(added), std::move(removed));
+	}
+
+	/**
+     * @brief Sets the number of threads used by View::ParallelEach, including the thread that calls it.
+     * Threads are started the first time a view iterates in parallel, and shared by all the views of the registry.
+     * WARNING: Must not be called while views are iterating in parallel.
+     * @param threads The number of threads; 0 for the number of hardware threads (the default).
+     */
+	void Threads(size_t threads)
+	{
+		indexer->Pool()->Resize(threads);
+	}
+
+	/**
+     * @brief Returns the thread pool of the registry, used by View::ParallelEach.
+     * @return The thread pool.
+     */
+	ThreadPool Pool()
+	{
+		return indexer->Pool();
+	}
+
+	/**
+     * @brief Saves the committed state of the registry to a snapshot file: entities, keys and component instances.
+     * Pending changes, policies, trackers and subscriptions are not saved.
+     * Trivially copyable components are written as raw bytes; other types need a specialization of Serializer.
+     * This function is NOT thread-safe.
+     * @param path The path of the file, which is replaced.
+     * @throw EntidyException if the file cannot be written, or a component type can neither be copied nor serialized.
+     * @example
+     * registry.Save("world.snapshot");
+     */
+	void Save(const string& path) const
+	{
+		indexer->Save(path);
+	}
+
+	/**
+     * @brief Restores a snapshot saved by Save into a registry where no entity has been created yet.
+     * Entity handles are the same as when the snapshot was saved. The types of the components must be registered
+     * before loading, with the same types as when the snapshot was saved. The file is mapped in memory where supported,
+     * and raw instances are copied into the memory pools in bulk.
+     * The restored instances are reported as added, and as changed, by the next commit.
+     * This function is NOT thread-safe.
+     * @param path The path of the file.
+     * @throw EntidyException if the registry is not empty, or the file is not a valid snapshot for the registered types.
+     * @example
+     * Entidy registry;
+     * registry.Register<Vec2f>("Position");
+     * registry.Register<Vec2f>("Velocity");
+     * registry.Load("world.snapshot");
+     */
+	void Load(const string& path)
+	{
+		indexer->Load(path);
+	}
+
+	/**
+     * @brief Starts or stops recording which entities are created and removed, so that commits can be captured by CaptureDelta.
+     * This function is NOT thread-safe.
+     * @param enabled true to record them, false to stop recording them.
+     */
+	void Replicate(bool enabled = true)
+	{
+		indexer->SetReplication(enabled);
+	}
+
+	/**
+     * @brief Captures the changes of the last commit in a delta, to be applied to replicas by ApplyDelta.
+     * The delta holds the entities that were created or removed, and for every tracked component (see Track), the entities
+     * that lost it and the instances that were emplaced or marked as changed, in the format of Save.
+     * Untracked components are not replicated; instances changed through pointers without being marked are not either.
+     * Must be called after every commit, before the next one; changes that are not captured are lost for replicas.
+     * This function is NOT thread-safe.
+     * @return The delta.
+     * @throw EntidyException if replication is not enabled, or the type of a tracked component can neither be copied nor serialized.
+     * @example
+     * registry.Replicate();
+     * registry.Track("Position");
+     * ...
+     * registry.Commit();
+     * network.Send(registry.CaptureDelta());
+     */
+	vector<char> CaptureDelta() const
+	{
+		return indexer->CaptureDelta();
+	}
+
+	/**
+     * @brief Applies a delta captured by CaptureDelta, then commits like Commit, without applying the pending changes.
+     * The replica must start from the same state as the source registry, both empty or loaded from the same snapshot
+     * saved right after a commit, and apply every delta in order. Entities keep the handles they have in the source registry.
+     * Deltas are numbered by the source registry: after the first one, a delta that was skipped or is applied twice is rejected.
+     * The types of the tracked components must be registered beforehand, as for Load.
+     * This function is NOT thread-safe.
+     * @param delta The delta.
+     * @throw EntidyException if the delta is corrupted or is not the one that follows the last delta applied. The replica is
+     * not modified if the delta is rejected.
+     * @example
+     * replica.Register<Vec2f>("Position");
+     * replica.ApplyDelta(network.Receive());
+     */
+	void ApplyDelta(const vector<char>& delta)
+	{
+		indexer->ApplyDelta(delta.data(), delta.size());
+		indexer->Pack();
+		indexer->NextEpoch();
+		indexer->Notify();
+	}
+
+	/**
+     * @brief Returns the memory used by the registry: for each component, its live instances, the blocks and capacity of
+     * its memory pool, the pages of its sparse vector and how full they are, and the size of its bitmap; then the alive
+     * entities, the pool of sparse vector pages, the archetype tables and the command buffer.
+     * Cheap enough to be polled periodically: no instance is visited, and the cost grows with the number of components
+     * and archetypes only. Roaring bitmaps are sized with getSizeInBytes, which approximates their footprint.
+     * This function is NOT thread-safe.
+     * @return The memory used by the registry.
+     * @example
+     * for(auto& component : registry.MemoryStats().components)
+     *     printf("%s: %zu instances, %zu bytes\n", component.key.c_str(), component.pool.items, component.pool.bytes);
+     */
+	MemoryUsage MemoryStats() const
+	{
+		MemoryUsage usage = indexer->GetMemoryUsage();
+		usage.command_bytes = commands->Capacity();
+		usage.total += usage.command_bytes;
+		return usage;
 	}
 
 	/**
      * @brief Removes orphaned entities, de-allocates redundant memory blocks and optimizes bitmaps.
-     * This action is executed during commit.
+     * This action is executed at the end of the next commit, after all the pending changes.
+     * Entities that have no components at that point are removed, and their handles become stale.
+     * With 'compact', components whose memory pools were left with many sparsely used blocks, e.g. after waves of
+     * entities were created and removed, are also defragmented: their instances are moved into as few blocks as possible,
+     * ordered by entity, so that they take less memory and views iterate over them more linearly. Only pools that would
+     * release at least half of their blocks are compacted, and room for the size hint of the component is kept.
+     * Pointers to the moved instances are invalidated. Types that are not move-constructible are never moved.
+     * This function is thread-safe.
+     * @param compact true to also compact fragmented component pools.
      */
-	void CleanUp()
+	void CleanUp(bool compact = false)
 	{
-		ddl.push_back([this]() { indexer->CleanUp(); });
+		lock_guard<SpinLock> guard(recording);
+		cleanup = true;
+		compaction = compaction || compact;
 	}
 
 	/**
-     * @brief Commits all the pending changes to the registry.
+     * @brief Commits all the pending changes to the registry, then calls the subscriptions to the components that changed.
+     * If constructing or moving an instance throws, the changes recorded before it are committed, the later ones are
+     * discarded, and the exception is rethrown; the epoch does not end, and no subscription is called.
      * This function is NOT thread-safe.
      */
 	void Commit()
 	{
-		for(auto& func : ddl)
-			func();
-		ddl.clear();
+		indexer->Apply(*commands);
+
+		if(cleanup)
+		{
+			indexer->CleanUp(compaction);
+			cleanup = false;
+			compaction = false;
+		}
+
+		indexer->Pack();
+		indexer->NextEpoch();
+		indexer->Notify();
 	}
 };
 } // namespace entidy
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#ifndef ENTIDY_GENERATION_BITS
+#	define ENTIDY_GENERATION_BITS 8
+#endif
+
+static_assert(ENTIDY_GENERATION_BITS >= 0 && ENTIDY_GENERATION_BITS < 32, "ENTIDY_GENERATION_BITS must be in [0, 32)");
+
+namespace entidy
+{
+
+/**
+ * @brief An entity handle.
+ * The low bits hold the index of the entity, used to key bitmaps and component storage,
+ * and the high ENTIDY_GENERATION_BITS bits hold its generation, which is incremented every time the entity is removed.
+ * A handle to a removed entity never matches the handle of the entity that recycles its index,
+ * until the generation wraps around after 2^ENTIDY_GENERATION_BITS removals.
+ * With ENTIDY_GENERATION_BITS set to 0, handles are plain indices.
+ */
+using Entity = uint32_t;
+
+constexpr uint32_t EntityIndexBits = 32 - ENTIDY_GENERATION_BITS;
+constexpr Entity EntityIndexMask = EntityIndexBits == 32 ? ~Entity(0) : (Entity(1) << EntityIndexBits) - 1;
+
+/**
+ * @brief Returns the index of an entity, without its generation.
+ */
+constexpr Entity EntityIndex(Entity entity)
+{
+	return entity & EntityIndexMask;
+}
+
+/**
+ * @brief Returns the generation of an entity, in place in the high bits of the handle.
+ */
+constexpr Entity EntityGeneration(Entity entity)
+{
+	return entity & ~EntityIndexMask;
+}
+
+} // namespace entidy
@@ -1,13 +1,25 @@
 #pragma once
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory_resource>
+#include <sstream>
 #include <typeinfo>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include <entidy/Archetype.h>
 #include <entidy/CRoaring/roaring.hh>
+#include <entidy/ChangeTracker.h>
+#include <entidy/CommandBuffer.h>
+#include <entidy/Entity.h>
 #include <entidy/Exception.h>
 #include <entidy/MemoryManager.h>
 #include <entidy/QueryParser.h>
+#include <entidy/Snapshot.h>
 #include <entidy/SparseVector.h>
+#include <entidy/ThreadPool.h>
 #include <entidy/View.h>
 
 namespace entidy
@@ -15,33 +27,219 @@ namespace entidy
 using namespace std;
 
 using BitMap = Roaring;
-using Entity = uint32_t;
+
+// Pooled: instances stay wherever the memory pool allocated them, and their addresses only change when CleanUp compacts the pool.
+// Packed: instances are moved during commit so that they are contiguous and ordered by entity.
+enum class StoragePolicy
+{
+	Pooled,
+	Packed
+};
+
+// Callbacks run after every commit, for each entity that gained or lost a component during the commit.
+struct ComponentListener
+{
+	function<void(Entity)> added;
+	function<void(Entity)> removed;
+};
+
+using Subscription = shared_ptr<ComponentListener>;
+
+// The entities that gained or lost a component during the last commit that changed it.
+// Only recorded while the component is watched or has listeners.
+struct ComponentEvents
+{
+	BitMap added;
+	BitMap removed;
+	// The epoch of the commit that produced the events
+	size_t epoch = 0;
+	bool watched = false;
+	vector<weak_ptr<ComponentListener>> listeners;
+};
 
 struct ComponentMap
 {
 	BitMap entities;
 	SparseVector<ENTIDY_DEFAULT_SV_SIZE> components;
 	MemoryManager mem_pool;
+	ComponentCodec codec;
 	size_t type = 0;
+	// The number of instances to expect, set by Entidy::SizeHint
+	size_t size_hint = 0;
+	AllocationPolicy allocation = AllocationPolicy::Heap;
+	int node = AnyNode;
+	bool pinned = false;
+	bool observed = false;
+	ChangeTracker tracker;
+	shared_ptr<ComponentEvents> events;
+
+	StoragePolicy storage = StoragePolicy::Pooled;
+	size_t displaced = 0;
+	Entity last_entity = 0;
+	intptr_t last_item = 0;
+};
+
+// The entities that gained or lost a component during a commit and have not been merged into its bitmap yet,
+// with the positions of their commands in the command buffer.
+struct PendingChanges
+{
+	vector<Entity> added;
+	vector<uint32_t> added_order;
+	vector<Entity> erased;
+	vector<uint32_t> erased_order;
+};
+
+// A set of components, sorted by index. Entities that have the same components share a signature.
+struct Signature
+{
+	vector<size_t> components;
+	// The signatures with one more or one less component, by component, found as entities move between signatures
+	unordered_map<size_t, size_t> edges;
+	// The entities that have the signature, with IterationPolicy::Archetype
+	ArchetypeTable table;
+};
+
+// The persistent result of a query, updated at every commit from the entities whose signatures changed.
+struct ObservedQuery
+{
+	vector<size_t> keys;
+	Token filter;
+	BitMap entities;
+	// Whether each signature matches the query: -1 if it has not been matched yet
+	vector<int8_t> matches;
+	size_t revision = 0;
+};
+
+// The memory used by a component, reported by Entidy::MemoryStats
+struct ComponentMemory
+{
+	string key;
+	// The live instances and the blocks of the memory pool that holds them; all zero for typeless components
+	PoolStats pool;
+	// The pages of the sparse vector that holds the addresses of the instances, and the share of their slots in use
+	size_t pages = 0;
+	double fill = 0;
+	// The size of the bitmap of the entities that have the component
+	size_t bitmap_bytes = 0;
+};
+
+// The memory used by a registry, reported by Entidy::MemoryStats. Sizes are in bytes.
+struct MemoryUsage
+{
+	vector<ComponentMemory> components;
+	size_t entities = 0;
+	size_t alive_bytes = 0;
+	// The pages of the sparse vectors indexed by entity: generations, signatures, and archetype rows
+	size_t entity_pages = 0;
+	// The pool of the pages of all the sparse vectors, shared by the components and the vectors indexed by entity
+	PoolStats sparse_pool;
+	size_t archetype_bytes = 0;
+	size_t command_bytes = 0;
+	// The sum of the pool storage, bitmaps, archetype chunks and command chunks
+	size_t total = 0;
 };
 
 class IndexerImpl;
 using Indexer = shared_ptr<IndexerImpl>;
 
+/**
+ * @brief A handle to a registered component.
+ * The key and the type of the component are resolved once, at registration,
+ * so that accessing the component through the handle skips key lookups and type checks.
+ * Components that were registered are never recycled by CleanUp, so handles remain valid for the lifetime of the registry.
+ * @tparam Type The component type, or void for typeless (flag) components.
+ */
+template <typename Type>
+class ComponentId
+{
+protected:
+	size_t index;
+
+	explicit ComponentId(size_t idx)
+		: index(idx)
+	{ }
+
+public:
+	/**
+     * @brief Creates an invalid handle, to be assigned with the result of Entidy::Register.
+     */
+	ComponentId()
+		: index(SIZE_MAX)
+	{ }
+
+	/**
+     * @brief Converts a handle into a read-only handle to the same component, e.g. for Entidy::Component<const Type>.
+     */
+	template <typename Other, typename = enable_if_t<is_same_v<Type, const Other>>>
+	ComponentId(ComponentId<Other> other)
+		: index(other.Index())
+	{ }
+
+	/**
+     * @brief Returns the index of the component.
+     * @return The component index.
+     */
+	size_t Index() const
+	{
+		return index;
+	}
+
+	friend IndexerImpl;
+};
+
 class IndexerImpl : public enable_shared_from_this<IndexerImpl>, public QueryParserAdapter<BitMap>
 {
 
 protected:
 	vector<Entity> entity_pool;
 	Entity entityRefCount = 1;
+	BitMap alive;
+	SparseVector<ENTIDY_DEFAULT_SV_SIZE> generations;
+
+	// Signature 0 is the empty set, which is the signature of every entity that is not in the sparse vector
+	vector<Signature> signatures;
+	map<vector<size_t>, size_t> signature_index;
+	vector<size_t> signature_pool;
+	SparseVector<ENTIDY_DEFAULT_SV_SIZE> entity_signatures;
+
+	// With IterationPolicy::Archetype, the row + 1 and signature + 1 of the table that holds each entity,
+	// and the entities whose rows must be updated at the end of the commit
+	IterationPolicy iteration = IterationPolicy::Bitmap;
+	SparseVector<ENTIDY_DEFAULT_SV_SIZE> table_rows;
+	SparseVector<ENTIDY_DEFAULT_SV_SIZE> table_signatures;
+	BitMap moved;
+
+	// The entities whose signatures changed since the observed queries were last updated
+	vector<weak_ptr<ObservedQuery>> observers;
+	BitMap changed;
+
+	// Incremented at every commit; tracked components report the changes of the epoch before the current one
+	size_t epoch = 0;
+
+	// The components whose events are recorded
+	vector<size_t> evented;
+
+	// With replication enabled, the entities that were created or removed, by epoch
+	ChangeTracker lifecycle;
+	// The sequence number of the next delta to apply, the epoch of the source registry after the last delta plus one;
+	// 0 until a delta is applied
+	uint64_t next_delta = 0;
 
 	vector<size_t> component_pool;
 	size_t componentRefCount = 0;
 
 	unordered_map<string, size_t> index;
 	vector<ComponentMap> maps;
+	size_t revision = 0;
 
+	// Allocates the memory blocks of the components and sparse vectors, and the chunks of the archetype tables
+	pmr::memory_resource* resource;
 	MemoryManager sv_mem_pool;
+	ThreadPool pool;
+
+	vector<PendingChanges> pending;
+	vector<size_t> touched;
+	vector<Entity> removals;
 
 	/**
      * @brief Creates a new component with key 'key'.
@@ -56,6 +254,8 @@ protected:
 		{
 			c = component_pool.back();
 			component_pool.pop_back();
+			maps[c] = ComponentMap();
+			maps[c].components = make_shared<SparseVectorImpl<ENTIDY_DEFAULT_SV_SIZE>>(sv_mem_pool);
 			index[key] = c;
 		}
 		else
@@ -69,259 +269,2630 @@ protected:
 	}
 
 	/**
-     * @brief Returns the index of the component with key 'key'.
-     * If the component does not exist, it is created.
-     * @param key The key for the requested component.
-     * @return The index of the component.
+     * @brief Associates component 'c' with Type on first use, and creates its memory pool.
+     * @tparam Type The component type.
+     * @param c The index of the component.
+     * @param key The key for the component, used in error messages.
+     * @throw EntidyException if the component had been previously associated with a different type, or registered as void.
      */
-	size_t ComponentIndex(const string& key)
+	template <typename Type>
+	void CheckType(size_t c, const string& key)
 	{
-		auto it = index.find(key);
-		if(it != index.end())
-			return it->second;
+		if(maps[c].type == 0 && maps[c].pinned)
+			throw(EntidyException("Component Type mismatch for key " + key));
 
-		return NewComponent(key);
-	}
+		if(!maps[c].mem_pool)
+		{
+			maps[c].mem_pool = MemoryManagerImpl::Create<Type>(maps[c].size_hint, resource);
+			maps[c].codec = ComponentCodecImpl::Create<Type>();
+			if(maps[c].allocation != AllocationPolicy::Heap || maps[c].node != AnyNode)
+				maps[c].mem_pool->SetAllocation(maps[c].allocation, maps[c].node);
+			if(maps[c].size_hint > 0)
+				maps[c].mem_pool->Reserve(maps[c].size_hint);
+		}
 
-public:
-	IndexerImpl()
-		: sv_mem_pool{MemoryManagerImpl::Create<Page<ENTIDY_DEFAULT_SV_SIZE>>()}
-	{ }
+		if(maps[c].type == 0)
+			maps[c].type = typeid(Type*).hash_code();
+
+		if(maps[c].type != typeid(Type*).hash_code())
+			throw(EntidyException("Component Type mismatch for key " + key));
+	}
 
 	/**
-     * @brief Returns a new or recycled entity.
-     * @return Entity.
+     * @brief Keeps track of whether a packed component is still contiguous and ordered by entity after an instance is added.
+     * @param map The component map.
+     * @param entity The entity that received the instance.
+     * @param item The address of the instance.
      */
-	Entity AddEntity()
+	void TrackPlacement(ComponentMap& map, Entity entity, intptr_t item)
 	{
-		Entity entity;
-		if(entity_pool.size() > 0)
+		if(entity > map.last_entity && item > map.last_item)
 		{
-			entity = entity_pool.back();
-			entity_pool.pop_back();
+			map.last_entity = entity;
+			map.last_item = item;
 		}
 		else
 		{
-			entity = entityRefCount++;
+			map.displaced++;
 		}
-		return entity;
 	}
 
 	/**
-     * @brief Removes an entity and deletes all its components.
-     * @param entity The entity to remove.
+     * @brief Moves the instances of a component into contiguous memory, ordered by entity, and updates their pointers.
+     * @param map The component map.
      */
-	void RemoveEntity(Entity entity)
+	void PackComponent(ComponentMap& map)
 	{
-		for(auto& map : maps)
+		vector<intptr_t> items;
+		vector<Entity> owners;
+		items.reserve(map.components->Size());
+		owners.reserve(map.components->Size());
+
+		for(Entity entity : map.entities)
 		{
-			map.entities.remove(entity);
-			intptr_t prev = map.components->Erase(entity);
-			if(prev != 0 && map.mem_pool)
-				map.mem_pool->Push(prev);
+			intptr_t item = map.components->Read(entity);
+			if(item == 0)
+				continue;
+			items.push_back(item);
+			owners.push_back(entity);
 		}
 
-		entity_pool.push_back(entity);
+		if(!map.mem_pool->Compact(items))
+			return;
+
+		for(size_t i = 0; i < items.size(); i++)
+			map.components->Write(owners[i], items[i]);
+
+		map.displaced = 0;
+		map.last_entity = owners.empty() ? 0 : owners.back();
+		map.last_item = items.empty() ? 0 : items.back();
 	}
 
 	/**
-     * @brief Checks if entity 'entity' has a component at key 'key'.
-     * @param entity The entity to check.
-     * @param key The key for the component to check.
+     * @brief Allocates an uninitialized instance for entity 'entity' and stores its address, without indexing the entity.
+     * A previous instance of the entity is sent back to the memory-manager for recycling.
+     * @param map The component map.
+     * @param entity The entity.
+     * @return The address of the uninitialized instance.
      */
-	bool HasComponent(Entity entity, const string& key)
+	intptr_t PlaceInstance(ComponentMap& map, Entity entity)
 	{
-		size_t c = ComponentIndex(key);
-		return maps[c].entities.contains(entity);
+		intptr_t cur = map.mem_pool->Pop();
+		StoreInstance(map, entity, cur);
+		return cur;
 	}
 
 	/**
-     * @brief Creates, indexes and returns a memory-managed instance of component.
-     * The new instance is allocated or recycled by the memory pool.
-     * If the component key does not exist, it is created and a Type association is saved.
-     * @tparam Type The component type.
+     * @brief Stores the address of an instance popped from the memory-manager for entity 'entity', without indexing the entity.
+     * A previous instance of the entity is sent back to the memory-manager for recycling.
+     * @param map The component map.
      * @param entity The entity.
-     * @param key The key for for the component to add.
-     * @return A pointer to the created component.
-     * @throw EntidyException if the key had been previously used for a different type.
+     * @param cur The address of the instance.
      */
-	template <typename Type>
-	Type* CreateComponent(Entity entity, const string& key)
+	void StoreInstance(ComponentMap& map, Entity entity, intptr_t cur)
 	{
-		size_t c = ComponentIndex(key);
-
-		if(!maps[c].mem_pool)
-			maps[c].mem_pool = MemoryManagerImpl::Create<Type>();
-
-		if(maps[c].type == 0)
-			maps[c].type = typeid(Type*).hash_code();
-
-		if(maps[c].type != typeid(Type*).hash_code())
-			throw(EntidyException("Component Type mismatch for key " + key));
-
-		intptr_t prev = maps[c].components->Read(entity);
+		intptr_t prev = map.components->Read(entity);
 		if(prev != 0)
-			maps[c].mem_pool->Push(prev);
+			map.mem_pool->Push(prev);
 
-		Type* cur = maps[c].mem_pool->Pop<Type>();
-		maps[c].components->Write(entity, (intptr_t)cur);
-		maps[c].entities.add(entity);
-		return cur;
+		map.components->Write(entity, cur);
+		if(map.storage == StoragePolicy::Packed)
+			TrackPlacement(map, entity, cur);
 	}
 
 	/**
-     * @brief Creates and indexes a typeless void component (used as a flag).
-     * No memory pool is created.
-     * If the component key does not exist, it is created.
+     * @brief Removes the instance of entity 'entity' and sends it back to the memory-manager, without un-indexing the entity.
+     * @param map The component map.
      * @param entity The entity.
-     * @param key The key for for the component to add.
-     * @throw EntidyException if the key had been previously used for a different type.
+     * @return false if the entity had no instance, true otherwise.
      */
-	void CreateVoidComponent(Entity entity, const string& key)
+	bool EraseInstance(ComponentMap& map, Entity entity)
 	{
-		size_t c = ComponentIndex(key);
-		if(maps[c].type != 0)
-			throw(EntidyException("Component Type mismatch for key " + key));
-		maps[c].entities.add(entity);
+		intptr_t prev = map.components->Erase(entity);
+		if(prev != 0 && map.mem_pool)
+		{
+			map.mem_pool->Push(prev);
+			if(map.storage == StoragePolicy::Packed)
+				map.displaced++;
+		}
+		return prev != 0;
 	}
 
 	/**
-     * @brief Deletes component with key 'key' for entity 'entity'.
-     * Also sends the instance back to the memory-manager for recycling.
-     * @param entity The entity.
-     * @param key The key for for the component to delete.
-     * @return false if component was not found, true otherwise.
+     * @brief Returns the index of the signature of entity 'entity'.
      */
-	bool DeleteComponent(Entity entity, const string& key)
+	size_t EntitySignature(Entity entity) const
 	{
-		size_t c = ComponentIndex(key);
-		maps[c].entities.remove(entity);
-		intptr_t prev = maps[c].components->Erase(entity);
-		if(prev != 0 && maps[c].mem_pool)
-			maps[c].mem_pool->Push(prev);
-		return prev != 0;
+		return size_t(entity_signatures->Read(entity));
 	}
 
 	/**
-     * @brief Returns a pointer to the component with key 'key' for entity 'entity'.
-     * NULL values are possible if 'entity' does not have a component for 'key'
-     * @tparam Type The component type.
-     * @param entity The entity.
-     * @param key The key for for the requested component.
-     * @return A pointer of type 'Type' to the component at 'key'.
-     * @throw EntidyException if the provided Type does not match with the type associated with 'key'.
+     * @brief Returns the signature that differs from signature 's' by component 'c' only, creating it on first use.
+     * @param s The index of the signature.
+     * @param c The index of the component to add to or remove from the signature.
+     * @return The index of the resulting signature.
      */
-	template <typename Type>
-	Type* GetComponent(Entity entity, const string& key)
+	size_t ToggleComponent(size_t s, size_t c)
 	{
-		size_t c = ComponentIndex(key);
-		if(maps[c].type != typeid(Type*).hash_code())
-			throw(EntidyException("Component Type mismatch for key " + key));
-		return (Type*)maps[c].components->Read(entity);
+		auto edge = signatures[s].edges.find(c);
+		if(edge != signatures[s].edges.end())
+			return edge->second;
+
+		vector<size_t> components = signatures[s].components;
+		auto it = lower_bound(components.begin(), components.end(), c);
+		if(it != components.end() && *it == c)
+			components.erase(it);
+		else
+			components.insert(it, c);
+
+		size_t next;
+		auto found = signature_index.find(components);
+		if(found != signature_index.end())
+		{
+			next = found->second;
+		}
+		else
+		{
+			if(signature_pool.size() > 0)
+			{
+				// Compiled queries may have matched the signature that held the index before
+				next = signature_pool.back();
+				signature_pool.pop_back();
+				++revision;
+			}
+			else
+			{
+				next = signatures.size();
+				signatures.push_back(Signature());
+			}
+			signatures[next].components = components;
+			signature_index.emplace(std::move(components), next);
+		}
+
+		signatures[s].edges[c] = next;
+		signatures[next].edges[c] = s;
+		return next;
 	}
 
 	/**
-     * @brief Performs a query and returns view with lists of pointers to the requested components.
-     * @param keys The ordered list of components requested. Empty list is allowed.
-     * @param filter Query string used to filter the entities.
-     * @return A View with lists of pointers to the requested components.
-     * @throw EntidyException if the filter string has a syntax error or is empty.
+     * @brief Adds component 'c' to, or removes it from, the signature of entity 'entity'.
+     * @param entity The index of the entity.
+     * @param c The index of the component.
+     * @param has true if the entity gained the component, false if it lost it.
      */
-	View Fetch(const vector<string>& keys, const string& filter)
+	void UpdateSignature(Entity entity, size_t c, bool has)
 	{
-		QueryParser<BitMap> qp(this);
-		BitMap query;
-
-		if(filter == "")
-			throw(EntidyException("No filter set"));
+		size_t s = EntitySignature(entity);
+		const vector<size_t>& components = signatures[s].components;
+		if(binary_search(components.begin(), components.end(), c) == has)
+			return;
 
-		query = qp.Parse(filter);
-		for(auto& k : keys)
-			query &= Evaluate(k);
+		size_t next = ToggleComponent(s, c);
+		if(next == 0)
+			entity_signatures->Erase(entity);
+		else
+			entity_signatures->Write(entity, intptr_t(next));
 
-        size_t total = query.cardinality();
-		vector<vector<intptr_t>> results(keys.size() + 1);
-		for(size_t k = 0; k < keys.size() + 1; k++)
-			results[k].resize(total);
+		if(!observers.empty())
+			changed.add(entity);
+	}
 
-		size_t i = 0;
-		auto it = query.begin();
-		while(it != query.end())
+	/**
+     * @brief Discards the signatures that contain recycled components, along with the edges that lead to them.
+     * No entity may have the recycled components.
+     * @param recycled The indices of the recycled components.
+     */
+	void DropSignatures(const vector<size_t>& recycled)
+	{
+		vector<bool> dropped(signatures.size(), false);
+		for(size_t s = 1; s < signatures.size(); s++)
 		{
-			results[0][i++] = *it;
-			++it;
+			for(size_t c : recycled)
+			{
+				auto& components = signatures[s].components;
+				if(binary_search(components.begin(), components.end(), c))
+				{
+					dropped[s] = true;
+					break;
+				}
+			}
 		}
 
-		vector<size_t> types(keys.size() + 1);
-		types[0] = typeid(Entity).hash_code();
-		for(size_t k = 0; k < keys.size(); k++)
+		for(size_t s = 0; s < signatures.size(); s++)
 		{
-			i = 0;
-			size_t c = ComponentIndex(keys[k]);
-
-			SparseVector<ENTIDY_DEFAULT_SV_SIZE> sv = maps[c].components;
-			types[k + 1] = maps[c].type;
+			if(dropped[s])
+			{
+				signature_index.erase(signatures[s].components);
+				signatures[s] = Signature();
+				signature_pool.push_back(s);
+				continue;
+			}
 
-			it = query.begin();
-			while(it != query.end())
+			auto& edges = signatures[s].edges;
+			for(auto it = edges.begin(); it != edges.end();)
 			{
-				results[k + 1][i++] = sv->Read(*it);
-				++it;
+				if(dropped[it->second])
+					it = edges.erase(it);
+				else
+					++it;
 			}
 		}
+	}
+
+	/**
+     * @brief Appends entity 'entity' to the table of signature 's', with the addresses of its components.
+     * @param s The index of the signature of the entity.
+     * @param entity The index of the entity.
+     */
+	void InsertRow(size_t s, Entity entity)
+	{
+		Signature& signature = signatures[s];
+		if(!signature.table)
+			signature.table = make_shared<ArchetypeTableImpl>(signature.components.size() + 1, resource);
+
+		ArchetypeTableImpl& table = *signature.table;
+		size_t row = table.Append();
+		table.Cell(row, 0) = intptr_t(entity | Entity(generations->Read(entity)));
+		for(size_t k = 0; k < signature.components.size(); k++)
+			table.Cell(row, k + 1) = maps[signature.components[k]].components->Read(entity);
+
+		table_rows->Write(entity, intptr_t(row + 1));
+		table_signatures->Write(entity, intptr_t(s + 1));
+	}
+
+	/**
+     * @brief Removes entity 'entity' from the table that holds it, if any.
+     * @param entity The index of the entity.
+     */
+	void EraseRow(Entity entity)
+	{
+		intptr_t row = table_rows->Erase(entity);
+		if(row == 0)
+			return;
+
+		size_t s = size_t(table_signatures->Erase(entity)) - 1;
+		Entity displaced = signatures[s].table->Remove(size_t(row) - 1);
+		if(displaced != 0)
+			table_rows->Write(EntityIndex(displaced), row);
+	}
+
+	/**
+     * @brief Moves the entities that were created, removed or changed since the last synchronization to the tables of their signatures.
+     */
+	void SyncTables()
+	{
+		for(Entity entity : moved)
+		{
+			EraseRow(entity);
+			if(alive.contains(entity))
+				InsertRow(EntitySignature(entity), entity);
+		}
+		moved = BitMap();
+	}
+
+	/**
+     * @brief Reads the addresses of component 'c' again in every table that has it, after its instances were moved.
+     * @param c The index of the component.
+     */
+	void RefreshColumn(size_t c)
+	{
+		for(auto& signature : signatures)
+		{
+			if(!signature.table || signature.table->Size() == 0)
+				continue;
+
+			auto it = lower_bound(signature.components.begin(), signature.components.end(), c);
+			if(it == signature.components.end() || *it != c)
+				continue;
 
-		return View(results, types);
+			ArchetypeTableImpl& table = *signature.table;
+			size_t column = size_t(it - signature.components.begin()) + 1;
+			for(size_t row = 0; row < table.Size(); row++)
+				table.Cell(row, column) = maps[c].components->Read(EntityIndex(Entity(table.Cell(row, 0))));
+		}
 	}
 
 	/**
-     * @brief Removes empty component pools and deallocates their reserved memory.
-     * Removes orphaned entities that have no components attached to them.
-     * Optimizes the bitmaps for faster queries and reduced memory consumption.
-     * Should be called infrequently, and only when too many temporary dynamic components were created and deleted.
+     * @brief Checks whether a set of components matches a resolved expression tree.
+     * @param token The root of the branch.
+     * @param components The sorted indices of the components.
+     * @return true if the components satisfy the branch, false otherwise.
      */
-	void CleanUp()
+	bool Matches(const Token& token, const vector<size_t>& components) const
 	{
-		auto it = index.begin();
-		while(it != index.end())
+		switch(token.op)
 		{
-			auto map = maps[it->second];
-			if(map.entities.cardinality() == 0)
-			{
-				component_pool.push_back(it->second);
-				it = index.erase(it);
-			}
-			else
-			{
-				++it;
-			}
-			map.entities.shrinkToFit();
+		case TokenType::Leaf:
+			return binary_search(components.begin(), components.end(), token.id);
+		case TokenType::And:
+			for(auto& child : token.children)
+				if(!Matches(child, components))
+					return false;
+			return true;
+		case TokenType::Or:
+			for(auto& child : token.children)
+				if(Matches(child, components))
+					return true;
+			return false;
+		case TokenType::Not:
+			return !Matches(token.children[0], components);
+		default:
+			throw(EntidyException("Bad Token: " + token.key));
 		}
+	}
 
-		// TODO: Remove orphaned entities
+	/**
+     * @brief Returns the entities whose instances of component 'c' were changed during the previous epoch, and that still have it.
+     * Components that are not tracked have no changes.
+     */
+	BitMap ChangedEntities(size_t c) const
+	{
+		const ComponentMap& map = maps[c];
+		if(!map.tracker)
+			return BitMap();
+		return map.tracker->Changed(epoch, map.entities);
 	}
 
-	// Query Parser Adapter Functions
-	virtual BitMap Evaluate(const string& token) override
+	/**
+     * @brief Returns the entities that gained component 'c' during the last commit.
+     * Components that are neither watched nor listened to have no events.
+     */
+	BitMap AddedEntities(size_t c) const
 	{
-		size_t id = ComponentIndex(token);
-		return maps[id].entities;
+		const ComponentMap& map = maps[c];
+		if(!map.events || map.events->epoch + 1 != epoch)
+			return BitMap();
+		return map.events->added;
 	}
 
-	virtual BitMap And(const BitMap& lhs, const BitMap& rhs) override
+	/**
+     * @brief Returns the entities that lost component 'c' during the last commit, and were not removed.
+     * Components that are neither watched nor listened to have no events.
+     */
+	BitMap RemovedEntities(size_t c) const
 	{
-		return lhs & rhs;
+		const ComponentMap& map = maps[c];
+		if(!map.events || map.events->epoch + 1 != epoch)
+			return BitMap();
+		return map.events->removed;
 	}
 
-	virtual BitMap Or(const BitMap& lhs, const BitMap& rhs) override
+	/**
+     * @brief Adds the entities that gained or lost a component during a merge to the events of the current commit.
+     * An entity that gains and loses the component during the same commit produces no event.
+     * @param events The events of the component.
+     * @param before The entities affected by the merge that had the component before it.
+     * @param after The entities affected by the merge that have the component after it.
+     */
+	void RecordEvents(ComponentEvents& events, const BitMap& before, const BitMap& after)
 	{
-		return lhs | rhs;
+		if(events.epoch != epoch)
+		{
+			events.added = BitMap();
+			events.removed = BitMap();
+			events.epoch = epoch;
+		}
+
+		BitMap added = after - before;
+		BitMap removed = before - after;
+		BitMap net_added = (events.added - removed) | (added - events.removed);
+		events.removed = (events.removed - added) | (removed - events.added);
+		events.added = std::move(net_added);
 	}
 
-	virtual BitMap Not(const BitMap& rhs) override
+	/**
+     * @brief Gives a view the trackers of its selected components, so that View::EachMut can mark the entities it visits.
+     */
+	void TrackColumns(View& view, const vector<size_t>& keys) const
+	{
+		view.epoch = epoch;
+		for(size_t k = 0; k < keys.size(); k++)
+		{
+			if(!maps[keys[k]].tracker)
+				continue;
+			view.trackers.resize(keys.size());
+			view.trackers[k] = maps[keys[k]].tracker;
+		}
+	}
+
+	/**
+     * @brief Checks whether a signature contains the selected components and matches a resolved expression tree.
+     */
+	bool Matches(const vector<size_t>& keys, const Token& filter, const vector<size_t>& components) const
+	{
+		for(size_t c : keys)
+			if(!binary_search(components.begin(), components.end(), c))
+				return false;
+		return Matches(filter, components);
+	}
+
+	/**
+     * @brief Adds the changed entities that match an observed query to its result, and removes the others.
+     * Every signature is matched once against the query; matches are discarded when signatures are recycled.
+     * @param observed The observed query.
+     */
+	void UpdateObserver(ObservedQuery& observed)
+	{
+		if(observed.revision != revision)
+		{
+			observed.matches.clear();
+			observed.revision = revision;
+		}
+		observed.matches.resize(signatures.size(), -1);
+
+		vector<Entity> added;
+		vector<Entity> erased;
+		for(Entity entity : changed)
+		{
+			if(!alive.contains(entity))
+			{
+				erased.push_back(entity);
+				continue;
+			}
+
+			size_t s = EntitySignature(entity);
+			if(observed.matches[s] < 0)
+				observed.matches[s] = Matches(observed.keys, observed.filter, signatures[s].components);
+			(observed.matches[s] ? added : erased).push_back(entity);
+		}
+
+		observed.entities.addMany(added.size(), added.data());
+		roaring_bitmap_remove_many(&observed.entities.roaring, erased.size(), erased.data());
+	}
+
+	/**
+     * @brief Updates the results of the observed queries that are still referenced, and forgets the others.
+     */
+	void UpdateObservers()
+	{
+		if(changed.isEmpty())
+			return;
+
+		auto it = observers.begin();
+		while(it != observers.end())
+		{
+			shared_ptr<ObservedQuery> observed = it->lock();
+			if(!observed)
+			{
+				it = observers.erase(it);
+				continue;
+			}
+			UpdateObserver(*observed);
+			++it;
+		}
+		changed = BitMap();
+	}
+
+	/**
+     * @brief Forgets the observed queries that are no longer referenced, and marks as observed only the components that the
+     * remaining ones use, so that CleanUp can recycle the others.
+     */
+	void RetainObservers()
+	{
+		for(auto& map : maps)
+			map.observed = false;
+
+		auto it = observers.begin();
+		while(it != observers.end())
+		{
+			shared_ptr<ObservedQuery> observed = it->lock();
+			if(!observed)
+			{
+				it = observers.erase(it);
+				continue;
+			}
+			for(size_t c : observed->keys)
+				maps[c].observed = true;
+			Retain(observed->filter);
+			++it;
+		}
+	}
+
+	/**
+     * @brief Merges the pending changes of a component into its bitmap, with a single bulk insertion or removal.
+     * If some entities both gained and lost the component, the last command wins.
+     * @param map The component map.
+     * @param changes The pending changes of the component; cleared on return.
+     */
+	void MergeChanges(ComponentMap& map, PendingChanges& changes)
+	{
+		// Erased entities are marked too, so that deltas carry the removals; Changed only reports entities that have the component
+		if(map.tracker && !changes.added.empty())
+			map.tracker->Mark(epoch, changes.added.size(), changes.added.data());
+		if(map.tracker && !changes.erased.empty())
+			map.tracker->Mark(epoch, changes.erased.size(), changes.erased.data());
+
+		// The entities affected by the merge, and which of them had the component before it
+		BitMap affected, before;
+		if(map.events)
+		{
+			affected.addMany(changes.added.size(), changes.added.data());
+			affected.addMany(changes.erased.size(), changes.erased.data());
+			before = map.entities & affected;
+		}
+
+		if(changes.erased.empty())
+		{
+			map.entities.addMany(changes.added.size(), changes.added.data());
+		}
+		else if(changes.added.empty())
+		{
+			roaring_bitmap_remove_many(&map.entities.roaring, changes.erased.size(), changes.erased.data());
+		}
+		else
+		{
+			BitMap added(changes.added.size(), changes.added.data());
+			BitMap erased(changes.erased.size(), changes.erased.data());
+
+			BitMap both = added & erased;
+			if(!both.isEmpty())
+			{
+				unordered_map<Entity, uint32_t> last_added;
+				for(size_t i = 0; i < changes.added.size(); i++)
+				{
+					if(both.contains(changes.added[i]))
+						last_added[changes.added[i]] = changes.added_order[i];
+				}
+				for(size_t i = 0; i < changes.erased.size(); i++)
+				{
+					auto it = last_added.find(changes.erased[i]);
+					if(it != last_added.end() && changes.erased_order[i] > it->second)
+						last_added.erase(it);
+				}
+				for(Entity entity : both)
+				{
+					if(last_added.count(entity) > 0)
+						erased.remove(entity);
+					else
+						added.remove(entity);
+				}
+			}
+
+			map.entities |= added;
+			map.entities -= erased;
+		}
+
+		if(map.events)
+			RecordEvents(*map.events, before, map.entities & affected);
+
+		changes.added.clear();
+		changes.added_order.clear();
+		changes.erased.clear();
+		changes.erased_order.clear();
+	}
+
+	/**
+     * @brief Merges the pending changes of every component touched since the last merge.
+     */
+	void MergeAllChanges()
+	{
+		for(size_t c : touched)
+			MergeChanges(maps[c], pending[c]);
+		touched.clear();
+	}
+
+	/**
+     * @brief Removes a batch of entities from the components they have, with a single bulk removal per bitmap.
+     * The entities are grouped by component using their signatures, so components that none of them has are not visited.
+     * Pending changes are merged first, so that the bitmaps are up to date.
+     */
+	void ApplyRemovals()
+	{
+		MergeAllChanges();
+
+		BitMap removed;
+		removed.addMany(removals.size(), removals.data());
+		removals.clear();
+
+		for(Entity entity : removed)
+		{
+			for(size_t c : signatures[EntitySignature(entity)].components)
+			{
+				EraseInstance(maps[c], entity);
+
+				PendingChanges& changes = pending[c];
+				if(changes.added.empty() && changes.erased.empty())
+					touched.push_back(c);
+				changes.erased.push_back(entity);
+			}
+		}
+		MergeAllChanges();
+
+		ReleaseEntities(removed);
+	}
+
+	/**
+     * @brief Increments the generation of the entity at index 'entity', so that its handles become stale.
+     */
+	void NextGeneration(Entity entity)
+	{
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+		{
+			Entity generation = Entity(generations->Read(entity)) + EntityIndexMask + 1;
+			if(generation == 0)
+				generations->Erase(entity);
+			else
+				generations->Write(entity, generation);
+		}
+	}
+
+	/**
+     * @brief Sizes the array of containers of a bitmap for indices up to 'count', one container per 65536 indices,
+     * so that adding them does not grow it.
+     */
+	static void ReserveBitMap(BitMap& bitmap, size_t count)
+	{
+		roaring_array_t& containers = bitmap.roaring.high_low_container;
+		int32_t needed = int32_t(min((count + 65535) / 65536, size_t(1) << 16));
+		if(needed > containers.size)
+			extend_array(&containers, needed - containers.size);
+	}
+
+	/**
+     * @brief Writes a bitmap to a snapshot, in Roaring's portable format, preceded by its size.
+     */
+	static void WriteBitMap(SnapshotWriter& out, const BitMap& bitmap)
+	{
+		vector<char> bytes(bitmap.getSizeInBytes());
+		bitmap.write(bytes.data());
+		uint64_t size = bytes.size();
+		out.Write(&size, sizeof(size));
+		out.Write(bytes.data(), bytes.size());
+	}
+
+	/**
+     * @brief Reads a bitmap written by WriteBitMap.
+     * @throw EntidyException if the bitmap is corrupted.
+     */
+	static BitMap ReadBitMap(SnapshotReader& in)
+	{
+		uint64_t size = in.Read<uint64_t>();
+		const char* bytes = in.Read(size_t(size));
+		try
+		{
+			return BitMap::readSafe(bytes, size_t(size));
+		}
+		catch(const std::exception&)
+		{
+			throw(EntidyException("Corrupted snapshot: bad bitmap"));
+		}
+	}
+
+	/**
+     * @brief Describes how the instances of a component are stored in a snapshot or a delta.
+     * @param map The component map.
+     * @param key The key for the component.
+     * @return The header of the component, without the sizes of its sections.
+     * @throw EntidyException if some instances of the component cannot be saved.
+     */
+	static SnapshotComponent DescribeComponent(const ComponentMap& map, const string& key)
+	{
+		SnapshotComponent section{};
+		section.type = map.type;
+		section.key = uint32_t(key.size());
+		if(map.codec)
+		{
+			section.size = uint32_t(map.codec->Size());
+			section.encoding = map.codec->GetEncoding();
+		}
+		if(map.type != 0 && section.encoding == Encoding::None && !map.entities.isEmpty())
+			throw(EntidyException("Component " + key + " cannot be saved; specialize Serializer for its type"));
+		return section;
+	}
+
+	/**
+     * @brief Serializes the instances of some entities through Serializer, in entity order, and sets the size of the data section.
+     * Serialized instances have variable sizes, so they are written to memory before the header of the component.
+     * @return The serialized instances, or an empty string if the component is not serialized.
+     */
+	static string SerializeInstances(const ComponentMap& map, SnapshotComponent& section, const BitMap& entities)
+	{
+		if(section.encoding == Encoding::Raw)
+			section.data = entities.cardinality() * section.size;
+		if(section.encoding != Encoding::Serialized)
+			return string();
+
+		ostringstream buffer(ios::binary);
+		for(Entity entity : entities)
+			map.codec->Save(buffer, map.components->Read(entity));
+		string serialized = buffer.str();
+		section.data = serialized.size();
+		return serialized;
+	}
+
+	/**
+     * @brief Writes the data section of a component: the raw bytes of the instances of some entities in entity order,
+     * or their serialized instances.
+     */
+	static void WriteInstances(SnapshotWriter& out, const ComponentMap& map, const SnapshotComponent& section, const BitMap& entities,
+							   const string& serialized)
+	{
+		if(section.encoding == Encoding::Serialized)
+		{
+			out.Write(serialized.data(), serialized.size());
+		}
+		else if(section.encoding == Encoding::Raw)
+		{
+			for(Entity entity : entities)
+				out.Write(reinterpret_cast<const void*>(map.components->Read(entity)), section.size);
+		}
+	}
+
+	/**
+     * @brief Reads serialized instances into new items of the memory pool of a component, without attaching them to entities,
+     * so that a corrupted section is found before the registry is modified.
+     * @param map The component map.
+     * @param data The data section of the component.
+     * @param length The length of the data section.
+     * @param count The number of instances.
+     * @return The addresses of the instances, in order.
+     * @throw EntidyException if the section is corrupted; the instances that were read are then destroyed.
+     */
+	static vector<intptr_t> ParseInstances(const ComponentMap& map, const char* data, size_t length, size_t count)
+	{
+		vector<intptr_t> items;
+		items.reserve(count);
+		intptr_t item = 0;
+		try
+		{
+			SnapshotReader::Parse(data, length, [&](istream& stream) {
+				for(size_t i = 0; i < count; i++)
+				{
+					item = map.mem_pool->Pop();
+					map.codec->Load(stream, item);
+					items.push_back(item);
+					item = 0;
+				}
+			});
+		}
+		catch(...)
+		{
+			if(item != 0)
+				map.mem_pool->Release(item);
+			for(intptr_t parsed : items)
+				map.mem_pool->Push(parsed);
+			throw;
+		}
+		return items;
+	}
+
+	/**
+     * @brief Checks that the instances of a component in a snapshot or a delta can be restored into component 'key'.
+     * @throw EntidyException if the type of the component is unknown or different.
+     */
+	void CheckSection(const string& key, const SnapshotComponent& section) const
+	{
+		if(section.encoding == Encoding::None)
+		{
+			if(section.type != 0)
+				throw(EntidyException("Corrupted snapshot: missing instances for component " + key));
+			if(index.count(key) > 0 && maps[index.at(key)].type != 0)
+				throw(EntidyException("Component Type mismatch for key " + key));
+			return;
+		}
+
+		auto it = index.find(key);
+		if(it == index.end() || !maps[it->second].codec)
+			throw(EntidyException("Unknown type for component " + key + "; register it before loading"));
+		const ComponentMap& map = maps[it->second];
+		if(map.type != section.type || map.codec->Size() != section.size || map.codec->GetEncoding() != section.encoding)
+			throw(EntidyException("Component Type mismatch for key " + key));
+	}
+
+	/**
+     * @brief Returns the handle that the entity at index 'entity' had before its last removal.
+     */
+	Entity PreviousHandle(Entity entity) const
+	{
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+			return entity | Entity(Entity(generations->Read(entity)) - (EntityIndexMask + 1));
+		else
+			return entity;
+	}
+
+	/**
+     * @brief Marks removed entities as dead, invalidates their handles and recycles their indices.
+     * @param removed The indices of the removed entities, which must be alive and have no components left.
+     */
+	void ReleaseEntities(const BitMap& removed)
+	{
+		for(Entity entity : removed)
+		{
+			entity_pool.push_back(entity);
+			entity_signatures->Erase(entity);
+			NextGeneration(entity);
+		}
+		alive -= removed;
+		if(iteration == IterationPolicy::Archetype)
+			moved |= removed;
+		if(!observers.empty())
+			changed |= removed;
+		if(lifecycle)
+			lifecycle->Mark(epoch, removed);
+	}
+
+	// An operand of an n-ary AND: either a branch of an expression tree, or a component (token == nullptr).
+	// Negated operands hold the branch under the NOT, and are subtracted from the intersection of the others.
+	struct Operand
+	{
+		uint64_t estimate;
+		const Token* token;
+		size_t id;
+		bool negated = false;
+	};
+
+	/**
+     * @brief Returns the bitmap of a component operand without copying it, or nullptr if the operand must be evaluated.
+     */
+	const BitMap* Leaf(const Operand& operand) const
+	{
+		if(operand.token == nullptr || operand.token->op == TokenType::Leaf)
+			return &maps[operand.id].entities;
+		return nullptr;
+	}
+
+	/**
+     * @brief Returns an estimate of the number of entities matched by a branch of an expression tree.
+     * Leaves are exact, AND is bounded by its smallest operand and OR by the sum of its operands.
+     * An estimate of 0 is only returned for branches that are certain to be empty.
+     * @param token The root of the branch.
+     * @return The estimated cardinality.
+     */
+	uint64_t Estimate(const Token& token) const
+	{
+		switch(token.op)
+		{
+		case TokenType::Leaf:
+			return maps[token.id].entities.cardinality();
+		case TokenType::And: {
+			uint64_t estimate = UINT64_MAX;
+			for(auto& child : token.children)
+				estimate = min(estimate, Estimate(child));
+			return estimate;
+		}
+		case TokenType::Or: {
+			uint64_t estimate = 0;
+			for(auto& child : token.children)
+				estimate += Estimate(child);
+			return estimate;
+		}
+		case TokenType::Not: {
+			uint64_t universe = alive.cardinality();
+			uint64_t estimate = Estimate(token.children[0]);
+			return estimate < universe ? universe - estimate : 0;
+		}
+		case TokenType::Changed: {
+			const ComponentMap& map = maps[token.children[0].id];
+			return map.tracker ? min(map.tracker->Count(epoch), map.entities.cardinality()) : 0;
+		}
+		case TokenType::Added:
+			return AddedEntities(token.children[0].id).cardinality();
+		case TokenType::Removed:
+			return RemovedEntities(token.children[0].id).cardinality();
+		default:
+			return alive.cardinality();
+		}
+	}
+
+	/**
+     * @brief Adds an operand to a list of AND operands, unless it is a component that is already in the list.
+     */
+	void AddOperand(const Operand& operand, vector<Operand>& operands) const
+	{
+		if(Leaf(operand) != nullptr)
+			for(auto& other : operands)
+				if(Leaf(other) != nullptr && other.id == operand.id && other.negated == operand.negated)
+					return;
+		operands.push_back(operand);
+	}
+
+	/**
+     * @brief Adds the children of an AND branch, or the branch itself, to a list of AND operands.
+     * NOT branches are added as negated operands.
+     */
+	void AddOperands(const Token& token, vector<Operand>& operands) const
+	{
+		if(token.op == TokenType::And)
+		{
+			for(auto& child : token.children)
+				AddOperands(child, operands);
+			return;
+		}
+
+		if(token.op == TokenType::Not)
+		{
+			const Token& child = token.children[0];
+			AddOperand(Operand{Estimate(child), &child, child.id, true}, operands);
+			return;
+		}
+
+		AddOperand(Operand{Estimate(token), &token, token.id}, operands);
+	}
+
+	/**
+     * @brief Intersects a list of operands, smallest first, so that the intermediate result only shrinks,
+     * then subtracts the negated operands from it (a & !b is evaluated as a andnot b).
+     * Component bitmaps are never copied: the first two operands are intersected into a new bitmap,
+     * and the others are intersected or subtracted in place. Stops as soon as the result is empty.
+     * If all the operands are negated, they are subtracted from the alive entities.
+     * @param operands The operands; reordered by this function.
+     * @return The intersection.
+     */
+	BitMap Intersect(vector<Operand>& operands)
+	{
+		if(operands.empty())
+			return BitMap();
+
+		auto negated = stable_partition(operands.begin(), operands.end(), [](const Operand& operand) { return !operand.negated; });
+		stable_sort(operands.begin(), negated, [](const Operand& lhs, const Operand& rhs) { return lhs.estimate < rhs.estimate; });
+		size_t positives = negated - operands.begin();
+
+		BitMap result;
+		size_t k = 1;
+		if(positives == 0)
+		{
+			result = alive;
+			k = 0;
+		}
+		else if(operands.front().estimate == 0)
+		{
+			return BitMap();
+		}
+		else
+		{
+			const BitMap* first = Leaf(operands[0]);
+			if(first != nullptr && positives > 1 && Leaf(operands[1]) != nullptr)
+			{
+				result = *first & *Leaf(operands[1]);
+				k = 2;
+			}
+			else
+			{
+				result = first != nullptr ? *first : Execute(*operands[0].token);
+			}
+		}
+
+		for(; k < operands.size() && !result.isEmpty(); k++)
+		{
+			const BitMap* leaf = Leaf(operands[k]);
+			BitMap evaluated;
+			if(leaf == nullptr)
+			{
+				evaluated = Execute(*operands[k].token);
+				leaf = &evaluated;
+			}
+
+			if(operands[k].negated)
+				result -= *leaf;
+			else
+				result &= *leaf;
+		}
+		return result;
+	}
+
+	/**
+     * @brief Unites the children of an OR branch, skipping empty operands.
+     * Component bitmaps are never copied: when a child had to be evaluated, the union is accumulated in place into
+     * the largest evaluated child; otherwise the components are merged with a single multi-way union.
+     * @param token The OR branch.
+     * @return The union.
+     */
+	BitMap Unite(const Token& token)
+	{
+		vector<BitMap> evaluated;
+		evaluated.reserve(token.children.size());
+		vector<const BitMap*> operands;
+
+		for(auto& child : token.children)
+		{
+			if(child.op == TokenType::Leaf)
+			{
+				if(!maps[child.id].entities.isEmpty())
+					operands.push_back(&maps[child.id].entities);
+			}
+			else
+			{
+				BitMap result = Execute(child);
+				if(!result.isEmpty())
+					evaluated.push_back(std::move(result));
+			}
+		}
+
+		if(evaluated.empty())
+		{
+			if(operands.empty())
+				return BitMap();
+			if(operands.size() == 1)
+				return *operands.front();
+			if(operands.size() == 2)
+				return *operands[0] | *operands[1];
+			return BitMap::fastunion(operands.size(), operands.data());
+		}
+
+		auto largest = max_element(evaluated.begin(), evaluated.end(), [](const BitMap& lhs, const BitMap& rhs) { return lhs.cardinality() < rhs.cardinality(); });
+		BitMap result = std::move(*largest);
+		for(auto it = evaluated.begin(); it != evaluated.end(); ++it)
+			if(it != largest)
+				result |= *it;
+		for(const BitMap* operand : operands)
+			result |= *operand;
+		return result;
+	}
+
+	/**
+     * @brief Evaluates a branch of a flattened expression tree, ordering the operands of AND by their estimated cardinality.
+     * @param token The root of the branch.
+     * @return The entities matched by the branch.
+     */
+	BitMap Execute(const Token& token)
+	{
+		switch(token.op)
+		{
+		case TokenType::Leaf:
+			return maps[token.id].entities;
+		case TokenType::And: {
+			vector<Operand> operands;
+			AddOperands(token, operands);
+			return Intersect(operands);
+		}
+		case TokenType::Or:
+			return Unite(token);
+		case TokenType::Not: {
+			const Token& child = token.children[0];
+			if(child.op == TokenType::Leaf)
+				return alive - maps[child.id].entities;
+			return alive - Execute(child);
+		}
+		case TokenType::Changed:
+			return ChangedEntities(token.children[0].id);
+		case TokenType::Added:
+			return AddedEntities(token.children[0].id);
+		case TokenType::Removed:
+			return RemovedEntities(token.children[0].id);
+		default:
+			throw(EntidyException("Bad Token: " + token.key));
+		}
+	}
+
+public:
+	/**
+     * @param memory The memory resource of the registry, which must outlive it; the default resource if null.
+     */
+	explicit IndexerImpl(pmr::memory_resource* memory = nullptr)
+		: resource{memory != nullptr ? memory : pmr::get_default_resource()}
+		, sv_mem_pool{MemoryManagerImpl::Create<Page<ENTIDY_DEFAULT_SV_SIZE>>(0, resource)}
+		, pool{make_shared<ThreadPoolImpl>()}
+	{
+		generations = make_shared<SparseVectorImpl<ENTIDY_DEFAULT_SV_SIZE>>(sv_mem_pool);
+		entity_signatures = make_shared<SparseVectorImpl<ENTIDY_DEFAULT_SV_SIZE>>(sv_mem_pool);
+		table_rows = make_shared<SparseVectorImpl<ENTIDY_DEFAULT_SV_SIZE>>(sv_mem_pool);
+		table_signatures = make_shared<SparseVectorImpl<ENTIDY_DEFAULT_SV_SIZE>>(sv_mem_pool);
+		signatures.push_back(Signature());
+		signature_index.emplace(vector<size_t>{}, 0);
+	}
+
+	/**
+     * @brief Returns the index of the component with key 'key'.
+     * If the component does not exist, it is created.
+     * @param key The key for the requested component.
+     * @return The index of the component.
+     */
+	size_t ComponentIndex(const string& key)
+	{
+		auto it = index.find(key);
+		if(it != index.end())
+			return it->second;
+
+		return NewComponent(key);
+	}
+
+	/**
+     * @brief Returns a new or recycled entity.
+     * @return Entity.
+     */
+	Entity AddEntity()
+	{
+		Entity entity;
+		if(entity_pool.size() > 0)
+		{
+			entity = entity_pool.back();
+			entity_pool.pop_back();
+		}
+		else
+		{
+			if(entityRefCount > EntityIndexMask)
+				throw(EntidyException("Out of entities; increase the number of index bits by lowering ENTIDY_GENERATION_BITS"));
+			entity = entityRefCount++;
+		}
+		alive.add(entity);
+		if(iteration == IterationPolicy::Archetype)
+			moved.add(entity);
+		if(!observers.empty())
+			changed.add(entity);
+		if(lifecycle)
+			lifecycle->Mark(epoch, entity);
+		return entity | Entity(generations->Read(entity));
+	}
+
+	/**
+     * @brief Checks whether a handle refers to an entity that was created and not removed since.
+     * Handles of removed entities are stale, even after their index is recycled.
+     * @param entity The entity handle.
+     * @return true if the entity is alive, false otherwise.
+     */
+	bool Alive(Entity entity) const
+	{
+		Entity index = EntityIndex(entity);
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+			return index != 0 && index < entityRefCount && Entity(generations->Read(index)) == EntityGeneration(entity);
+		else
+			return alive.contains(index);
+	}
+
+	/**
+     * @brief Removes an entity and deletes all its components.
+     * Only the components in the signature of the entity are visited.
+     * Stale handles are ignored.
+     * @param entity The entity to remove.
+     */
+	void RemoveEntity(Entity entity)
+	{
+		if(!Alive(entity))
+			return;
+
+		entity = EntityIndex(entity);
+		for(size_t c : signatures[EntitySignature(entity)].components)
+		{
+			maps[c].entities.remove(entity);
+			EraseInstance(maps[c], entity);
+		}
+
+		BitMap removed;
+		removed.add(entity);
+		ReleaseEntities(removed);
+	}
+
+	/**
+     * @brief Checks if entity 'entity' has a component at key 'key'.
+     * @param entity The entity to check.
+     * @param key The key for the component to check.
+     */
+	bool HasComponent(Entity entity, const string& key)
+	{
+		return HasComponent(entity, ComponentIndex(key));
+	}
+
+	/**
+     * @brief Checks if entity 'entity' has the component at index 'c'.
+     * @param entity The entity to check.
+     * @param c The index of the component to check.
+     */
+	bool HasComponent(Entity entity, size_t c) const
+	{
+		return Alive(entity) && maps[c].entities.contains(EntityIndex(entity));
+	}
+
+	/**
+     * @brief Resolves component 'key' and associates it with Type, so that it can be accessed through a handle.
+     * The component is never recycled by CleanUp.
+     * @tparam Type The component type.
+     * @param key The key for the component.
+     * @return A handle to the component.
+     * @throw EntidyException if the key had been previously used for a different type.
+     */
+	template <typename Type>
+	ComponentId<Type> RegisterComponent(const string& key)
+	{
+		ComponentId<Type> id = LookupComponent<Type>(key);
+		maps[id.index].pinned = true;
+		return id;
+	}
+
+	/**
+     * @brief Resolves the typeless void component 'key' (used as a flag), so that it can be accessed through a handle.
+     * The component is never recycled by CleanUp.
+     * @param key The key for the component.
+     * @return A handle to the component.
+     * @throw EntidyException if the key had been previously used for a non-void type.
+     */
+	ComponentId<void> RegisterComponent(const string& key)
+	{
+		ComponentId<void> id = LookupComponent(key);
+		maps[id.index].pinned = true;
+		return id;
+	}
+
+	/**
+     * @brief Resolves component 'key' and associates it with Type, without pinning it.
+     * The returned handle is only valid until the next CleanUp.
+     * @tparam Type The component type.
+     * @param key The key for the component.
+     * @return A handle to the component.
+     * @throw EntidyException if the key had been previously used for a different type.
+     */
+	template <typename Type>
+	ComponentId<Type> LookupComponent(const string& key)
+	{
+		size_t c = ComponentIndex(key);
+		CheckType<Type>(c, key);
+		return ComponentId<Type>(c);
+	}
+
+	/**
+     * @brief Resolves the typeless void component 'key' (used as a flag), without pinning it.
+     * The returned handle is only valid until the next CleanUp.
+     * @param key The key for the component.
+     * @return A handle to the component.
+     * @throw EntidyException if the key had been previously used for a non-void type.
+     */
+	ComponentId<void> LookupComponent(const string& key)
+	{
+		size_t c = ComponentIndex(key);
+		if(maps[c].type != 0)
+			throw(EntidyException("Component Type mismatch for key " + key));
+		return ComponentId<void>(c);
+	}
+
+	/**
+     * @brief Creates, indexes and returns a memory-managed instance of component.
+     * The new instance is allocated or recycled by the memory pool.
+     * If the component key does not exist, it is created and a Type association is saved.
+     * @tparam Type The component type.
+     * @param entity The entity.
+     * @param key The key for for the component to add.
+     * @return A pointer to the created component.
+     * @throw EntidyException if the key had been previously used for a different type.
+     */
+	template <typename Type>
+	Type* CreateComponent(Entity entity, const string& key)
+	{
+		size_t c = ComponentIndex(key);
+		CheckType<Type>(c, key);
+		return CreateComponent<Type>(entity, ComponentId<Type>(c));
+	}
+
+	/**
+     * @brief Creates, indexes and returns a memory-managed instance of a registered component.
+     * No key lookups or type checks are performed.
+     * @tparam Type The component type.
+     * @param entity The entity.
+     * @param id The handle of the component to add.
+     * @return A pointer to the created component.
+     */
+	template <typename Type>
+	Type* CreateComponent(Entity entity, ComponentId<Type> id)
+	{
+		return reinterpret_cast<Type*>(CreateComponent(entity, id.index));
+	}
+
+	/**
+     * @brief Indexes and returns an uninitialized memory-managed instance of the component at index 'c'.
+     * The component must already be associated with a type.
+     * @param entity The entity.
+     * @param c The index of the component to add.
+     * @return The address of the uninitialized instance.
+     */
+	intptr_t CreateComponent(Entity entity, size_t c)
+	{
+		intptr_t cur = PlaceInstance(maps[c], EntityIndex(entity));
+		maps[c].entities.add(EntityIndex(entity));
+		UpdateSignature(EntityIndex(entity), c, true);
+		return cur;
+	}
+
+	/**
+     * @brief Creates and indexes a typeless void component (used as a flag).
+     * No memory pool is created.
+     * If the component key does not exist, it is created.
+     * @param entity The entity.
+     * @param key The key for for the component to add.
+     * @throw EntidyException if the key had been previously used for a different type.
+     */
+	void CreateVoidComponent(Entity entity, const string& key)
+	{
+		size_t c = ComponentIndex(key);
+		if(maps[c].type != 0)
+			throw(EntidyException("Component Type mismatch for key " + key));
+		CreateVoidComponent(entity, ComponentId<void>(c));
+	}
+
+	/**
+     * @brief Indexes a registered typeless void component (used as a flag).
+     * @param entity The entity.
+     * @param id The handle of the component to add.
+     */
+	void CreateVoidComponent(Entity entity, ComponentId<void> id)
+	{
+		maps[id.index].entities.add(EntityIndex(entity));
+		UpdateSignature(EntityIndex(entity), id.index, true);
+	}
+
+	/**
+     * @brief Deletes component with key 'key' for entity 'entity'.
+     * Also sends the instance back to the memory-manager for recycling.
+     * @param entity The entity.
+     * @param key The key for for the component to delete.
+     * @return false if component was not found, true otherwise.
+     */
+	bool DeleteComponent(Entity entity, const string& key)
+	{
+		return DeleteComponent(entity, ComponentIndex(key));
+	}
+
+	/**
+     * @brief Deletes the component at index 'c' for entity 'entity'.
+     * Also sends the instance back to the memory-manager for recycling.
+     * @param entity The entity.
+     * @param c The index of the component to delete.
+     * @return false if component was not found, true otherwise.
+     */
+	bool DeleteComponent(Entity entity, size_t c)
+	{
+		maps[c].entities.remove(EntityIndex(entity));
+		UpdateSignature(EntityIndex(entity), c, false);
+		return EraseInstance(maps[c], EntityIndex(entity));
+	}
+
+	/**
+     * @brief Sets how the instances of component 'key' are laid out in memory.
+     * Switching to StoragePolicy::Packed packs the existing instances during the next call to Pack.
+     * @param key The key for the component.
+     * @param policy The storage policy.
+     */
+	void SetStoragePolicy(const string& key, StoragePolicy policy)
+	{
+		size_t c = ComponentIndex(key);
+		maps[c].storage = policy;
+		maps[c].displaced = policy == StoragePolicy::Packed ? maps[c].components->Size() : 0;
+		maps[c].last_entity = 0;
+		maps[c].last_item = 0;
+	}
+
+	/**
+     * @brief Applies the commands recorded in a command buffer, in order, and resets the buffer.
+     * Instances are created and deleted as commands are read, but bitmaps are updated in bulk:
+     * the entities that gained or lost each component are merged into its bitmap once,
+     * and consecutive entity removals are applied together, with one intersection per component.
+     * The instances carried by Emplace commands are moved into the memory pools.
+     * Commands on stale entity handles are dropped, and their instances destroyed.
+     * With IterationPolicy::Archetype, the entities that changed are then moved to the tables of their signatures.
+     * Observed queries are updated from the entities whose signatures changed.
+     * If a command throws, e.g. when moving its instance, the commands before it are kept, the buffer is reset anyway, and
+     * the instances of the other commands are destroyed; the entity of the failed command keeps its previous instance.
+     * @param commands The command buffer.
+     */
+	void Apply(CommandBufferImpl& commands)
+	{
+		if(pending.size() < maps.size())
+			pending.resize(maps.size());
+
+		try
+		{
+			ApplyCommands(commands);
+		}
+		catch(...)
+		{
+			FinishApply(commands);
+			throw;
+		}
+		FinishApply(commands);
+	}
+
+	/**
+     * @brief Applies the commands of a command buffer to the sparse vectors and signatures, and records the pending changes
+     * of the bitmaps, which FinishApply merges.
+     * @param commands The command buffer.
+     */
+	void ApplyCommands(CommandBufferImpl& commands)
+	{
+		uint32_t order = 0;
+		commands.Each([this, &order](Command& cmd) {
+			if(cmd.type == CommandType::Remove)
+			{
+				if(Alive(cmd.entity))
+					removals.push_back(EntityIndex(cmd.entity));
+				return;
+			}
+
+			if(!removals.empty())
+				ApplyRemovals();
+
+			// Changes to entities removed before the command are dropped
+			if(!Alive(cmd.entity))
+				return;
+			Entity entity = EntityIndex(cmd.entity);
+			if(iteration == IterationPolicy::Archetype)
+				moved.add(entity);
+
+			ComponentMap& map = maps[cmd.component];
+			PendingChanges& changes = pending[cmd.component];
+			if(changes.added.empty() && changes.erased.empty())
+				touched.push_back(cmd.component);
+
+			if(cmd.type == CommandType::Emplace)
+			{
+				if(cmd.move != nullptr)
+				{
+					// The instance is only stored once it was moved, so that a throwing move leaves the previous one in place
+					intptr_t cur = map.mem_pool->Pop();
+					try
+					{
+						cmd.move(reinterpret_cast<void*>(cur), cmd.Payload());
+					}
+					catch(...)
+					{
+						map.mem_pool->Release(cur);
+						throw;
+					}
+					cmd.destroy = nullptr;
+					StoreInstance(map, entity, cur);
+				}
+				UpdateSignature(entity, cmd.component, true);
+				changes.added.push_back(entity);
+				changes.added_order.push_back(order++);
+			}
+			else
+			{
+				EraseInstance(map, entity);
+				UpdateSignature(entity, cmd.component, false);
+				changes.erased.push_back(entity);
+				changes.erased_order.push_back(order++);
+			}
+		});
+	}
+
+	/**
+     * @brief Merges the changes recorded by ApplyCommands into the bitmaps, tables and observed queries, and resets the
+     * command buffer, destroying the instances that were not moved out of it, even if merging throws.
+     * @param commands The command buffer.
+     */
+	void FinishApply(CommandBufferImpl& commands)
+	{
+		try
+		{
+			if(!removals.empty())
+				ApplyRemovals();
+			MergeAllChanges();
+			SyncTables();
+			UpdateObservers();
+		}
+		catch(...)
+		{
+			commands.Reset();
+			throw;
+		}
+		commands.Reset();
+	}
+
+	/**
+     * @brief Packs the instances of every component with StoragePolicy::Packed that are no longer contiguous or ordered by entity.
+     * Pointers to the instances of these components are invalidated, and archetype tables are updated.
+     */
+	void Pack()
+	{
+		for(size_t c = 0; c < maps.size(); c++)
+		{
+			auto& map = maps[c];
+			if(map.storage == StoragePolicy::Packed && map.displaced > 0 && map.mem_pool)
+			{
+				PackComponent(map);
+				if(iteration == IterationPolicy::Archetype)
+					RefreshColumn(c);
+			}
+		}
+	}
+
+	/**
+     * @brief Sets whether compiled queries iterate over archetype tables.
+     * Switching to IterationPolicy::Archetype builds the tables of all the entities; switching back discards them.
+     * @param policy The iteration policy.
+     */
+	void SetIterationPolicy(IterationPolicy policy)
+	{
+		if(policy == iteration)
+			return;
+
+		iteration = policy;
+		moved = BitMap();
+		table_rows = make_shared<SparseVectorImpl<ENTIDY_DEFAULT_SV_SIZE>>(sv_mem_pool);
+		table_signatures = make_shared<SparseVectorImpl<ENTIDY_DEFAULT_SV_SIZE>>(sv_mem_pool);
+		for(auto& signature : signatures)
+			signature.table = nullptr;
+
+		if(policy == IterationPolicy::Archetype)
+			for(Entity entity : alive)
+				InsertRow(EntitySignature(entity), entity);
+	}
+
+	/**
+     * @brief Starts or stops tracking the changes of component 'key'.
+     * Tracked components are never recycled by CleanUp.
+     * @param key The key for the component.
+     * @param enabled true to track the changes of the component, false to stop tracking them and discard them.
+     */
+	void SetTracking(const string& key, bool enabled)
+	{
+		size_t c = ComponentIndex(key);
+		if(!enabled)
+			maps[c].tracker = nullptr;
+		else if(!maps[c].tracker)
+			maps[c].tracker = make_shared<ChangeTrackerImpl>(epoch);
+	}
+
+	/**
+     * @brief Sets the number of instances of component 'key' to expect, and allocates memory for them in advance:
+     * the blocks of its memory pool, sized after the hint, and the pages of its sparse vector.
+     * If the type of the component is not known yet, blocks are allocated when it is first used.
+     * @param key The key for the component.
+     * @param size_hint The number of instances.
+     */
+	void SetSizeHint(const string& key, size_t size_hint)
+	{
+		ComponentMap& map = maps[ComponentIndex(key)];
+		map.size_hint = size_hint;
+		map.components->Reserve(size_hint);
+		ReserveBitMap(map.entities, size_hint);
+
+		size_t live = map.components->Size();
+		if(size_hint <= live)
+			return;
+		if(map.mem_pool)
+			map.mem_pool->Reserve(size_hint - live);
+		sv_mem_pool->Reserve((size_hint - live + ENTIDY_DEFAULT_SV_SIZE - 1) / ENTIDY_DEFAULT_SV_SIZE);
+	}
+
+	/**
+     * @brief Sets how the memory blocks of component 'key' are allocated, and on which NUMA node.
+     * Applies to the blocks allocated from now on; blocks are only sized for huge pages if the component has no instances yet.
+     * @param key The key for the component.
+     * @param policy How blocks are allocated.
+     * @param node The NUMA node of the blocks: AnyNode, LocalNode or the number of a node.
+     */
+	void SetAllocationPolicy(const string& key, AllocationPolicy policy, int node)
+	{
+		ComponentMap& map = maps[ComponentIndex(key)];
+		map.allocation = policy;
+		map.node = node;
+		if(map.mem_pool)
+			map.mem_pool->SetAllocation(policy, node);
+	}
+
+	/**
+     * @brief Allocates memory in advance for a total of 'count' entities: the lists of pages of the sparse vectors indexed
+     * by entity, the pages that hold the signatures of the new entities, and the containers of the bitmap of alive entities.
+     * @param count The number of entities.
+     */
+	void Reserve(size_t count)
+	{
+		size_t indices = min(count + 1, size_t(EntityIndexMask) + 1);
+		generations->Reserve(indices);
+		entity_signatures->Reserve(indices);
+		if(iteration == IterationPolicy::Archetype)
+		{
+			table_rows->Reserve(indices);
+			table_signatures->Reserve(indices);
+		}
+		ReserveBitMap(alive, indices);
+
+		if(indices <= entityRefCount)
+			return;
+		size_t pages = (indices - entityRefCount + ENTIDY_DEFAULT_SV_SIZE - 1) / ENTIDY_DEFAULT_SV_SIZE;
+		sv_mem_pool->Reserve(iteration == IterationPolicy::Archetype ? 3 * pages : pages);
+	}
+
+	/**
+     * @brief Returns the memory used by every component and by the structures indexed by entity.
+     * Runs in time proportional to the number of components, signatures and bitmap containers; no instance is visited.
+     * The command buffer is not known to the indexer, and is left to the caller.
+     * @return The memory used by the registry.
+     */
+	MemoryUsage GetMemoryUsage() const
+	{
+		MemoryUsage usage;
+		usage.components.reserve(index.size());
+		for(auto& [key, c] : index)
+		{
+			const ComponentMap& map = maps[c];
+			ComponentMemory component;
+			component.key = key;
+			if(map.mem_pool)
+				component.pool = map.mem_pool->Stats();
+			component.pages = map.components->Pages();
+			if(component.pages > 0)
+				component.fill = double(map.components->Size()) / double(component.pages * ENTIDY_DEFAULT_SV_SIZE);
+			component.bitmap_bytes = map.entities.getSizeInBytes(false);
+
+			usage.total += component.pool.bytes + component.bitmap_bytes;
+			usage.components.push_back(std::move(component));
+		}
+		sort(usage.components.begin(), usage.components.end(), [](const ComponentMemory& a, const ComponentMemory& b) { return a.key < b.key; });
+
+		usage.entities = alive.cardinality();
+		usage.alive_bytes = alive.getSizeInBytes(false);
+		usage.entity_pages = generations->Pages() + entity_signatures->Pages() + table_rows->Pages() + table_signatures->Pages();
+		usage.sparse_pool = sv_mem_pool->Stats();
+		for(auto& signature : signatures)
+		{
+			if(signature.table)
+				usage.archetype_bytes += signature.table->Bytes();
+		}
+
+		usage.total += usage.alive_bytes + usage.sparse_pool.bytes + usage.archetype_bytes;
+		return usage;
+	}
+
+	/**
+     * @brief Starts or stops recording the entities that are created and removed, for CaptureDelta.
+     * @param enabled true to record them, false to stop recording them and discard them.
+     */
+	void SetReplication(bool enabled)
+	{
+		if(!enabled)
+			lifecycle = nullptr;
+		else if(!lifecycle)
+			lifecycle = make_shared<ChangeTrackerImpl>(epoch);
+	}
+
+	/**
+     * @brief Returns the events of component 'c', creating them if needed.
+     */
+	ComponentEvents& Events(size_t c)
+	{
+		if(!maps[c].events)
+		{
+			maps[c].events = make_shared<ComponentEvents>();
+			maps[c].events->epoch = epoch;
+			evented.push_back(c);
+		}
+		return *maps[c].events;
+	}
+
+	/**
+     * @brief Starts or stops recording the entities that gain or lose component 'key' at every commit.
+     * Watched components are never recycled by CleanUp.
+     * @param key The key for the component.
+     * @param enabled true to record the events of the component, false to stop recording them once it has no listeners.
+     */
+	void SetWatching(const string& key, bool enabled)
+	{
+		size_t c = ComponentIndex(key);
+		if(enabled)
+			Events(c).watched = true;
+		else if(maps[c].events)
+			maps[c].events->watched = false;
+	}
+
+	/**
+     * @brief Adds callbacks for the entities that gain or lose component 'key', run by Notify after every commit.
+     * @param key The key for the component.
+     * @param added Called with the handle of every entity that gained the component, or null.
+     * @param removed Called with the handle of every entity that lost the component, or null.
+     * @return The subscription; the callbacks are run until the last reference to it is released.
+     */
+	Subscription Subscribe(const string& key, function<void(Entity)> added, function<void(Entity)> removed)
+	{
+		auto listener = make_shared<ComponentListener>(ComponentListener{std::move(added), std::move(removed)});
+		Events(ComponentIndex(key)).listeners.push_back(listener);
+		return listener;
+	}
+
+	/**
+     * @brief Runs the listeners of the components that changed during the last commit, and stops recording the events
+     * of components that are no longer watched nor listened to.
+     * Entities that lost a component because they were removed are passed with the handle they had before their removal,
+     * and are not reported by Removed in queries.
+     * Must be called after NextEpoch.
+     */
+	void Notify()
+	{
+		// Listeners may subscribe to other components, so the list is re-read at every step
+		size_t e = 0;
+		while(e < evented.size())
+		{
+			size_t c = evented[e];
+			shared_ptr<ComponentEvents> events = maps[c].events;
+			auto& listeners = events->listeners;
+			listeners.erase(remove_if(listeners.begin(), listeners.end(), [](const weak_ptr<ComponentListener>& listener) { return listener.expired(); }),
+							listeners.end());
+			if(listeners.empty() && !events->watched)
+			{
+				maps[c].events = nullptr;
+				evented.erase(evented.begin() + e);
+				continue;
+			}
+			e++;
+
+			if(events->epoch + 1 != epoch)
+				continue;
+
+			for(size_t l = 0; l < listeners.size(); l++)
+			{
+				shared_ptr<ComponentListener> listener = listeners[l].lock();
+				if(!listener)
+					continue;
+				if(listener->added)
+					for(Entity entity : events->added)
+						listener->added(entity | Entity(generations->Read(entity)));
+				if(listener->removed)
+					for(Entity entity : events->removed)
+						listener->removed(alive.contains(entity) ? entity | Entity(generations->Read(entity)) : PreviousHandle(entity));
+			}
+			events->removed &= alive;
+		}
+	}
+
+	/**
+     * @brief Ends the current epoch: the changes marked so far become the changes of the previous epoch.
+     */
+	void NextEpoch()
+	{
+		++epoch;
+	}
+
+	/**
+     * @brief Returns the current epoch, incremented at every commit.
+     * @return The epoch.
+     */
+	size_t Epoch() const
+	{
+		return epoch;
+	}
+
+	/**
+     * @brief Returns whether compiled queries iterate over archetype tables.
+     * @return The iteration policy.
+     */
+	IterationPolicy Iteration() const
+	{
+		return iteration;
+	}
+
+	/**
+     * @brief Returns a pointer to the component with key 'key' for entity 'entity'.
+     * NULL values are possible if 'entity' does not have a component for 'key', or is stale.
+     * If the component is tracked, the entity is marked as changed, unless Type is const.
+     * @tparam Type The component type, const-qualified for read-only access.
+     * @param entity The entity.
+     * @param key The key for for the requested component.
+     * @return A pointer of type 'Type' to the component at 'key'.
+     * @throw EntidyException if the provided Type does not match with the type associated with 'key'.
+     */
+	template <typename Type>
+	Type* GetComponent(Entity entity, const string& key)
+	{
+		size_t c = ComponentIndex(key);
+		if(maps[c].type != typeid(remove_const_t<Type>*).hash_code())
+			throw(EntidyException("Component Type mismatch for key " + key));
+		return GetComponent(entity, ComponentId<Type>(c));
+	}
+
+	/**
+     * @brief Returns a pointer to a registered component for entity 'entity'.
+     * NULL values are possible if 'entity' does not have the component, or is stale.
+     * If the component is tracked, the entity is marked as changed, unless Type is const.
+     * No key lookups or type checks are performed.
+     * @tparam Type The component type, const-qualified for read-only access.
+     * @param entity The entity.
+     * @param id The handle of the requested component.
+     * @return A pointer of type 'Type' to the component.
+     */
+	template <typename Type>
+	Type* GetComponent(Entity entity, ComponentId<Type> id) const
+	{
+		if(!Alive(entity))
+			return nullptr;
+
+		const ComponentMap& map = maps[id.index];
+		Type* component = (Type*)map.components->Read(EntityIndex(entity));
+		if constexpr(!is_const_v<Type>)
+		{
+			if(component != nullptr && map.tracker)
+				map.tracker->Mark(epoch, EntityIndex(entity));
+		}
+		return component;
+	}
+
+	/**
+     * @brief Returns the indices of the components with keys 'keys'.
+     * Components that do not exist are created.
+     * @param keys The ordered list of component keys.
+     * @return The ordered list of component indices.
+     */
+	vector<size_t> ComponentIndices(const vector<string>& keys)
+	{
+		vector<size_t> ids(keys.size());
+		for(size_t k = 0; k < keys.size(); k++)
+			ids[k] = ComponentIndex(keys[k]);
+		return ids;
+	}
+
+	/**
+     * @brief Parses a filter string into an expression tree whose leaves are resolved to component indices.
+     * @param filter Query string used to filter the entities.
+     * @return The root of the resolved expression tree.
+     * @throw EntidyException if the filter string has a syntax error or is empty.
+     */
+	Token Compile(const string& filter)
+	{
+		if(filter == "")
+			throw(EntidyException("No filter set"));
+
+		QueryParser<BitMap> qp(this);
+		return qp.Compile(filter);
+	}
+
+	/**
+     * @brief Returns a counter that is incremented every time component or signature indices are recycled.
+     * Resolved component indices, expression trees and matched signatures are only valid as long as the revision does not change.
+     * @return The current revision.
+     */
+	size_t Revision() const
+	{
+		return revision;
+	}
+
+	/**
+     * @brief Returns the thread pool used by views to iterate in parallel.
+     * @return The thread pool.
+     */
+	ThreadPool Pool() const
+	{
+		return pool;
+	}
+
+	/**
+     * @brief Performs a query and returns a view over the matching entities and the requested components.
+     * @param keys The ordered list of components requested. Empty list is allowed.
+     * @param filter Query string used to filter the entities.
+     * @return A View over the matching entities and the requested components.
+     * @throw EntidyException if the filter string has a syntax error or is empty.
+     */
+	View Fetch(const vector<string>& keys, const string& filter)
+	{
+		return Fetch(ComponentIndices(keys), Compile(filter));
+	}
+
+	/**
+     * @brief Performs a pre-compiled query and returns a view over the matching entities and the requested components.
+     * No parsing or key lookups are performed, and component pointers are only read when the view is iterated.
+     * @param keys The ordered list of indices of the components requested. Empty list is allowed.
+     * @param filter Expression tree returned by Compile.
+     * @return A View over the matching entities and the requested components.
+     */
+	View Fetch(const vector<size_t>& keys, const Token& filter)
+	{
+		// The selected components are intersected along with the filter, so that the smallest sets go first
+		vector<Operand> operands;
+		AddOperands(filter, operands);
+		for(size_t c : keys)
+			AddOperand(Operand{maps[c].entities.cardinality(), nullptr, c}, operands);
+		return Fetch(keys, Intersect(operands));
+	}
+
+	/**
+     * @brief Returns a view over a set of entities and the requested components.
+     * @param keys The ordered list of indices of the components requested. Empty list is allowed.
+     * @param entities The indices of the entities, which must have the requested components.
+     * @return A View over the entities and the requested components.
+     */
+	View Fetch(const vector<size_t>& keys, BitMap entities)
+	{
+		vector<SparseVector<ENTIDY_DEFAULT_SV_SIZE>> columns(keys.size());
+		vector<size_t> types(keys.size() + 1);
+		types[0] = typeid(Entity).hash_code();
+		for(size_t k = 0; k < keys.size(); k++)
+		{
+			columns[k] = maps[keys[k]].components;
+			types[k + 1] = maps[keys[k]].type;
+		}
+
+		View view(std::move(entities), columns, types, generations, pool);
+		TrackColumns(view, keys);
+		return view;
+	}
+
+	/**
+     * @brief Creates a query whose result is kept up to date at every commit, from the entities whose signatures changed.
+     * The selected components and the components in the filter are never recycled by CleanUp.
+     * The query is updated until the last reference to it is released.
+     * @param keys The ordered list of indices of the components requested, which the entities must have.
+     * @param filter Expression tree returned by Compile, which must not use predicates such as Changed.
+     * @return The observed query, with the result of the query on the committed entities.
+     * @throw EntidyException if the filter uses predicates.
+     */
+	shared_ptr<ObservedQuery> Observe(const vector<size_t>& keys, const Token& filter)
+	{
+		if(!Structural(filter))
+			throw(EntidyException("Observed queries can only depend on the components of the entities"));
+
+		auto observed = make_shared<ObservedQuery>();
+		observed->keys = keys;
+		observed->filter = filter;
+		observed->revision = revision;
+
+		for(size_t c : keys)
+			maps[c].observed = true;
+		Retain(filter);
+
+		vector<Operand> operands;
+		AddOperands(filter, operands);
+		for(size_t c : keys)
+			AddOperand(Operand{maps[c].entities.cardinality(), nullptr, c}, operands);
+		observed->entities = Intersect(operands);
+
+		observers.push_back(observed);
+		return observed;
+	}
+
+	/**
+     * @brief Marks the components in the leaves of a resolved expression tree as observed, so they are never recycled by CleanUp.
+     */
+	void Retain(const Token& token)
+	{
+		if(token.op == TokenType::Leaf)
+			maps[token.id].observed = true;
+		for(auto& child : token.children)
+			Retain(child);
+	}
+
+	/**
+     * @brief Checks whether an expression tree only depends on which components the entities have,
+     * so that it can be matched against signatures.
+     * @param filter Expression tree returned by Compile.
+     * @return false if the filter uses predicates such as Changed, true otherwise.
+     */
+	bool Structural(const Token& filter) const
+	{
+		return !filter.ContainsPredicate();
+	}
+
+	/**
+     * @brief Matches the signatures created since the last call against the selected components and a pre-compiled filter.
+     * Signatures are never modified once created, so every signature only needs to be matched once per query.
+     * @param keys The indices of the selected components, which the signatures must contain.
+     * @param filter Expression tree returned by Compile.
+     * @param matched Receives the indices of the matching signatures.
+     * @param checked The number of signatures already matched; updated on return.
+     */
+	void MatchSignatures(const vector<size_t>& keys, const Token& filter, vector<size_t>& matched, size_t& checked) const
+	{
+		for(; checked < signatures.size(); checked++)
+		{
+			if(Matches(keys, filter, signatures[checked].components))
+				matched.push_back(checked);
+		}
+	}
+
+	/**
+     * @brief Returns a view over the archetype tables of the matched signatures and the requested components.
+     * No bitmaps are evaluated: views iterate over the rows of the tables, which hold the addresses of the components.
+     * @param keys The ordered list of indices of the components requested. Empty list is allowed.
+     * @param matched The signatures returned by MatchSignatures for the same keys.
+     * @return A View over the entities of the tables and the requested components.
+     */
+	View FetchArchetypes(const vector<size_t>& keys, const vector<size_t>& matched)
+	{
+		vector<ArchetypeSlice> slices;
+		for(size_t s : matched)
+		{
+			const Signature& signature = signatures[s];
+			if(!signature.table || signature.table->Size() == 0)
+				continue;
+
+			ArchetypeSlice slice{signature.table, vector<size_t>(keys.size())};
+			for(size_t k = 0; k < keys.size(); k++)
+				slice.columns[k] = size_t(lower_bound(signature.components.begin(), signature.components.end(), keys[k]) - signature.components.begin()) + 1;
+			slices.push_back(std::move(slice));
+		}
+
+		vector<SparseVector<ENTIDY_DEFAULT_SV_SIZE>> columns(keys.size());
+		vector<size_t> types(keys.size() + 1);
+		types[0] = typeid(Entity).hash_code();
+		for(size_t k = 0; k < keys.size(); k++)
+		{
+			columns[k] = maps[keys[k]].components;
+			types[k + 1] = maps[keys[k]].type;
+		}
+
+		View view(std::move(slices), columns, types, generations, pool);
+		TrackColumns(view, keys);
+		return view;
+	}
+
+	/**
+     * @brief Writes the committed entities, their generations and the instances of their components to a snapshot file.
+     * Each component is saved with its key, its entities in Roaring's portable format, and its instances ordered by entity:
+     * trivially copyable instances as raw contiguous bytes aligned to ENTIDY_SNAPSHOT_ALIGNMENT, other instances through Serializer.
+     * Instances are stored in the byte order of the host.
+     * @param path The path of the file, which is replaced.
+     * @throw EntidyException if the file cannot be written, or some instances cannot be saved.
+     */
+	void Save(const string& path) const
+	{
+		vector<pair<size_t, string>> keys;
+		for(auto& [key, c] : index)
+		{
+			DescribeComponent(maps[c], key);
+			keys.push_back({c, key});
+		}
+		sort(keys.begin(), keys.end());
+
+		ofstream file(path, ios::binary | ios::trunc);
+		if(!file)
+			throw(EntidyException("Cannot write snapshot " + path));
+		SnapshotWriter out(file);
+		SnapshotHeader header{{'E', 'N', 'T', 'I', 'D', 'Y', 'S', 'S'}, 1, ENTIDY_GENERATION_BITS, entityRefCount, uint32_t(keys.size())};
+		out.Write(&header, sizeof(header));
+		WriteBitMap(out, alive);
+		out.Align(8);
+
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+		{
+			vector<uint32_t> generation_list(entityRefCount);
+			for(Entity entity = 1; entity < entityRefCount; entity++)
+				generation_list[entity] = uint32_t(generations->Read(entity));
+			out.Write(generation_list.data(), generation_list.size() * sizeof(uint32_t));
+			out.Align(8);
+		}
+
+		for(auto& [c, key] : keys)
+		{
+			const ComponentMap& map = maps[c];
+			SnapshotComponent section = DescribeComponent(map, key);
+			section.bitmap = map.entities.getSizeInBytes();
+
+			string serialized = SerializeInstances(map, section, map.entities);
+
+			out.Write(&section, sizeof(section));
+			out.Write(key.data(), key.size());
+			out.Align(8);
+			WriteBitMap(out, map.entities);
+			out.Align(ENTIDY_SNAPSHOT_ALIGNMENT);
+			WriteInstances(out, map, section, map.entities, serialized);
+			out.Align(8);
+		}
+		out.Flush();
+	}
+
+	/**
+     * @brief Restores the entities and components saved by Save into an empty registry.
+     * The file is mapped in memory: raw instances are copied into the memory pools in bulk, and serialized instances are read
+     * through Serializer. Entities keep their handles. Every restored instance counts as emplaced by the next commit,
+     * for change tracking and events.
+     * The types of the saved components must have been associated with their keys beforehand (see Entidy::Register);
+     * flags need not be.
+     * @param path The path of the file.
+     * @throw EntidyException if the registry is not empty, the file cannot be read or is corrupted,
+     * or the type of a component is unknown or different. The registry is not modified if the file is rejected.
+     */
+	void Load(const string& path)
+	{
+		if(entityRefCount != 1)
+			throw(EntidyException("Snapshots can only be loaded into an empty registry"));
+
+		SnapshotReader in(path);
+		SnapshotHeader header = in.Read<SnapshotHeader>();
+		if(memcmp(header.magic, "ENTIDYSS", 8) != 0 || header.version != 1)
+			throw(EntidyException("Not a snapshot: " + path));
+		if(header.generation_bits != ENTIDY_GENERATION_BITS)
+			throw(EntidyException("Snapshot was saved with ENTIDY_GENERATION_BITS = " + to_string(header.generation_bits)));
+		if(header.entities == 0 || header.entities - 1 > EntityIndexMask)
+			throw(EntidyException("Corrupted snapshot: bad entity count"));
+
+		BitMap saved_alive = ReadBitMap(in);
+		in.Align(8);
+		if(!saved_alive.isEmpty() && (saved_alive.minimum() == 0 || saved_alive.maximum() >= header.entities))
+			throw(EntidyException("Corrupted snapshot: bad entities"));
+
+		const uint32_t* generation_list = nullptr;
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+		{
+			generation_list = reinterpret_cast<const uint32_t*>(in.Read(size_t(header.entities) * sizeof(uint32_t)));
+			in.Align(8);
+		}
+
+		// Components are all checked before the registry is modified
+		struct Section
+		{
+			string key;
+			SnapshotComponent header;
+			BitMap entities;
+			const char* data;
+		};
+		vector<Section> sections;
+		unordered_set<string> seen;
+		for(uint32_t k = 0; k < header.components; k++)
+		{
+			Section& section = sections.emplace_back();
+			section.header = in.Read<SnapshotComponent>();
+			section.key = string(in.Read(section.header.key), section.header.key);
+			in.Align(8);
+			section.entities = ReadBitMap(in);
+			in.Align(ENTIDY_SNAPSHOT_ALIGNMENT);
+			section.data = in.Read(section.header.data);
+			in.Align(8);
+
+			if(!seen.insert(section.key).second)
+				throw(EntidyException("Corrupted snapshot: duplicate component " + section.key));
+			if(!section.entities.isSubset(saved_alive))
+				throw(EntidyException("Corrupted snapshot: bad entities for component " + section.key));
+			if(section.header.encoding == Encoding::Raw && section.header.data != section.entities.cardinality() * section.header.size)
+				throw(EntidyException("Corrupted snapshot: bad instances for component " + section.key));
+
+			// Keys without entities are restored whatever their type
+			if(section.entities.isEmpty())
+				continue;
+
+			CheckSection(section.key, section.header);
+		}
+
+		// Serialized instances are read before the registry is modified, and destroyed if any of them is corrupted
+		vector<vector<intptr_t>> parsed(sections.size());
+		try
+		{
+			for(size_t k = 0; k < sections.size(); k++)
+			{
+				Section& section = sections[k];
+				if(section.header.encoding == Encoding::Serialized && !section.entities.isEmpty())
+					parsed[k] = ParseInstances(maps[index.at(section.key)], section.data, size_t(section.header.data),
+											   section.entities.cardinality());
+			}
+		}
+		catch(...)
+		{
+			for(size_t k = 0; k < sections.size(); k++)
+				for(intptr_t item : parsed[k])
+					maps[index.at(sections[k].key)].mem_pool->Push(item);
+			throw;
+		}
+
+		entityRefCount = header.entities;
+		alive = std::move(saved_alive);
+		for(Entity entity = entityRefCount - 1; entity > 0; entity--)
+		{
+			if(generation_list != nullptr && generation_list[entity] != 0)
+				generations->Write(entity, intptr_t(generation_list[entity]));
+			if(!alive.contains(entity))
+				entity_pool.push_back(entity);
+		}
+
+		for(size_t k = 0; k < sections.size(); k++)
+		{
+			Section& section = sections[k];
+			size_t c = ComponentIndex(section.key);
+			if(section.entities.isEmpty())
+				continue;
+
+			ComponentMap& map = maps[c];
+			vector<intptr_t>& items = parsed[k];
+			if(section.header.encoding == Encoding::Raw)
+				map.mem_pool->Adopt(section.data, section.entities.cardinality(), items);
+
+			size_t i = 0;
+			for(Entity entity : section.entities)
+			{
+				if(!items.empty())
+				{
+					map.components->Write(entity, items[i]);
+					if(map.storage == StoragePolicy::Packed)
+						TrackPlacement(map, entity, items[i]);
+					i++;
+				}
+				UpdateSignature(entity, c, true);
+			}
+
+			map.entities = std::move(section.entities);
+			if(map.tracker)
+				map.tracker->Mark(epoch, map.entities);
+			if(map.events)
+				RecordEvents(*map.events, BitMap(), map.entities);
+		}
+
+		if(iteration == IterationPolicy::Archetype)
+			moved |= alive;
+		if(!observers.empty())
+			changed |= alive;
+		if(lifecycle)
+		{
+			BitMap restored;
+			restored.addRange(1, entityRefCount);
+			lifecycle->Mark(epoch, restored);
+		}
+		SyncTables();
+		UpdateObservers();
+	}
+
+	/**
+     * @brief Writes the changes of the previous epoch to a delta, for ApplyDelta: the entities that were created or removed,
+     * with their generations, and for every tracked component, the entities that lost it and the instances that were
+     * emplaced or changed, in the format of the snapshots.
+     * Deltas are numbered with the current epoch, so that replicas can tell whether one was skipped or repeated.
+     * Untracked components are not included.
+     * @return The delta.
+     * @throw EntidyException if replication is not enabled, or the instances of a tracked component cannot be saved.
+     */
+	vector<char> CaptureDelta() const
+	{
+		if(!lifecycle)
+			throw(EntidyException("Replication is not enabled"));
+
+		// The indices that were created or removed, at least once, and which of them are alive
+		BitMap spawned = lifecycle->Previous(epoch);
+		BitMap born = spawned & alive;
+
+		struct Section
+		{
+			size_t c;
+			string key;
+			BitMap changed;
+			BitMap removed;
+		};
+		vector<Section> sections;
+		for(auto& [key, c] : index)
+		{
+			const ComponentMap& map = maps[c];
+			if(!map.tracker)
+				continue;
+			DescribeComponent(map, key);
+
+			// Entities that were removed lose all their components, and need not be listed
+			BitMap marked = map.tracker->Previous(epoch);
+			if(!marked.isEmpty())
+				sections.push_back({c, key, marked & map.entities, marked - map.entities - spawned});
+		}
+		sort(sections.begin(), sections.end(), [](const Section& lhs, const Section& rhs) { return lhs.c < rhs.c; });
+
+		ostringstream stream(ios::binary);
+		SnapshotWriter out(stream);
+		SnapshotHeader header{{'E', 'N', 'T', 'I', 'D', 'Y', 'D', 'L'}, 2, ENTIDY_GENERATION_BITS, entityRefCount, uint32_t(sections.size())};
+		uint64_t sequence = epoch;
+		out.Write(&header, sizeof(header));
+		out.Write(&sequence, sizeof(sequence));
+		WriteBitMap(out, spawned);
+		out.Align(8);
+		WriteBitMap(out, born);
+		out.Align(8);
+
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+		{
+			vector<uint32_t> generation_list;
+			generation_list.reserve(spawned.cardinality());
+			for(Entity entity : spawned)
+				generation_list.push_back(uint32_t(generations->Read(entity)));
+			out.Write(generation_list.data(), generation_list.size() * sizeof(uint32_t));
+			out.Align(8);
+		}
+
+		for(auto& section : sections)
+		{
+			const ComponentMap& map = maps[section.c];
+			SnapshotComponent component = DescribeComponent(map, section.key);
+			component.bitmap = section.changed.getSizeInBytes();
+
+			string serialized = SerializeInstances(map, component, section.changed);
+
+			out.Write(&component, sizeof(component));
+			out.Write(section.key.data(), section.key.size());
+			out.Align(8);
+			WriteBitMap(out, section.changed);
+			out.Align(8);
+			WriteBitMap(out, section.removed);
+			out.Align(8);
+			WriteInstances(out, map, component, section.changed, serialized);
+			out.Align(8);
+		}
+		out.Flush();
+
+		string bytes = stream.str();
+		return vector<char>(bytes.begin(), bytes.end());
+	}
+
+	/**
+     * @brief Applies a delta written by CaptureDelta to a replica, whose entities and tracked components must be in the state
+     * of the source registry before the changes of the delta.
+     * Entities are created and removed with the same handles as in the source registry. Changed raw instances are copied over
+     * the current instances, so their addresses do not change; other instances are emplaced.
+     * Every change counts as done by the next commit, for change tracking, events and observed queries.
+     * @param bytes The delta.
+     * @param length The length of the delta, in bytes.
+     * The first delta is accepted whatever its number; every following delta must be the next one captured by the source.
+     * @throw EntidyException if the delta is corrupted, is not the delta that follows the last one applied, or the type of
+     * a component is unknown or different. The registry is not modified if the delta is rejected.
+     */
+	void ApplyDelta(const char* bytes, size_t length)
+	{
+		SnapshotReader in(bytes, length);
+		SnapshotHeader header = in.Read<SnapshotHeader>();
+		if(memcmp(header.magic, "ENTIDYDL", 8) != 0 || header.version != 2)
+			throw(EntidyException("Not a delta"));
+		if(header.generation_bits != ENTIDY_GENERATION_BITS)
+			throw(EntidyException("Delta was captured with ENTIDY_GENERATION_BITS = " + to_string(header.generation_bits)));
+		uint64_t sequence = in.Read<uint64_t>();
+		if(next_delta != 0 && sequence != next_delta)
+			throw(EntidyException("Delta " + to_string(sequence) + " does not follow the state of the replica, which expects delta "
+								  + to_string(next_delta)));
+		if(header.entities < entityRefCount || header.entities - 1 > EntityIndexMask)
+			throw(EntidyException("Corrupted delta: bad entity count"));
+
+		BitMap spawned = ReadBitMap(in);
+		in.Align(8);
+		BitMap born = ReadBitMap(in);
+		in.Align(8);
+
+		// Every index beyond the entities of the replica must have been created
+		if(!spawned.isEmpty() && (spawned.minimum() == 0 || spawned.maximum() >= header.entities))
+			throw(EntidyException("Corrupted delta: bad entities"));
+		if(!born.isSubset(spawned) || spawned.rank(header.entities - 1) - spawned.rank(entityRefCount - 1) != header.entities - entityRefCount)
+			throw(EntidyException("Corrupted delta: bad entities"));
+		BitMap survivors = (alive - spawned) | born;
+
+		const uint32_t* generation_list = nullptr;
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+		{
+			generation_list = reinterpret_cast<const uint32_t*>(in.Read(size_t(spawned.cardinality()) * sizeof(uint32_t)));
+			in.Align(8);
+		}
+
+		// Components are all checked before the registry is modified
+		struct Section
+		{
+			string key;
+			SnapshotComponent header;
+			BitMap changed;
+			BitMap removed;
+			const char* data;
+		};
+		vector<Section> sections;
+		unordered_set<string> seen;
+		for(uint32_t k = 0; k < header.components; k++)
+		{
+			Section& section = sections.emplace_back();
+			section.header = in.Read<SnapshotComponent>();
+			section.key = string(in.Read(section.header.key), section.header.key);
+			in.Align(8);
+			section.changed = ReadBitMap(in);
+			in.Align(8);
+			section.removed = ReadBitMap(in);
+			in.Align(8);
+			section.data = in.Read(section.header.data);
+			in.Align(8);
+
+			if(!seen.insert(section.key).second)
+				throw(EntidyException("Corrupted delta: duplicate component " + section.key));
+			if(!section.changed.isSubset(survivors) || !section.removed.isSubset(survivors) || section.changed.intersect(section.removed))
+				throw(EntidyException("Corrupted delta: bad entities for component " + section.key));
+			if(section.header.encoding == Encoding::Raw && section.header.data != section.changed.cardinality() * section.header.size)
+				throw(EntidyException("Corrupted delta: bad instances for component " + section.key));
+
+			if(!section.changed.isEmpty())
+				CheckSection(section.key, section.header);
+		}
+
+		// Serialized instances are read before the registry is modified, and destroyed if any of them is corrupted
+		vector<vector<intptr_t>> parsed(sections.size());
+		try
+		{
+			for(size_t k = 0; k < sections.size(); k++)
+			{
+				Section& section = sections[k];
+				if(section.header.encoding == Encoding::Serialized && !section.changed.isEmpty())
+					parsed[k] = ParseInstances(maps[index.at(section.key)], section.data, size_t(section.header.data),
+											   section.changed.cardinality());
+			}
+		}
+		catch(...)
+		{
+			for(size_t k = 0; k < sections.size(); k++)
+				for(intptr_t item : parsed[k])
+					maps[index.at(sections[k].key)].mem_pool->Push(item);
+			throw;
+		}
+		next_delta = sequence + 1;
+
+		vector<size_t> components;
+		for(auto& section : sections)
+			components.push_back(ComponentIndex(section.key));
+		if(pending.size() < maps.size())
+			pending.resize(maps.size());
+
+		// Indices that were removed, and possibly created again, lose all their components
+		BitMap removed = spawned & alive;
+		for(Entity entity : removed)
+			removals.push_back(entity);
+		if(!removals.empty())
+			ApplyRemovals();
+
+		for(Entity entity = entityRefCount; entity < header.entities; entity++)
+			if(!born.contains(entity))
+				entity_pool.push_back(entity);
+		entityRefCount = header.entities;
+
+		if(!born.isEmpty())
+		{
+			entity_pool.erase(remove_if(entity_pool.begin(), entity_pool.end(), [&born](Entity entity) { return born.contains(entity); }),
+							  entity_pool.end());
+			alive |= born;
+			if(iteration == IterationPolicy::Archetype)
+				moved |= born;
+			if(!observers.empty())
+				changed |= born;
+		}
+
+		if(generation_list != nullptr)
+		{
+			size_t i = 0;
+			for(Entity entity : spawned)
+			{
+				if(generation_list[i] != 0)
+					generations->Write(entity, intptr_t(generation_list[i]));
+				else
+					generations->Erase(entity);
+				i++;
+			}
+		}
+		if(lifecycle)
+			lifecycle->Mark(epoch, spawned - removed);
+
+		uint32_t order = 0;
+		for(size_t k = 0; k < sections.size(); k++)
+		{
+			Section& section = sections[k];
+			size_t c = components[k];
+			ComponentMap& map = maps[c];
+			PendingChanges& changes = pending[c];
+			touched.push_back(c);
+
+			for(Entity entity : section.removed)
+			{
+				EraseInstance(map, entity);
+				UpdateSignature(entity, c, false);
+				changes.erased.push_back(entity);
+				changes.erased_order.push_back(order++);
+			}
+
+			vector<intptr_t>& items = parsed[k];
+			size_t i = 0;
+			for(Entity entity : section.changed)
+			{
+				if(section.header.encoding == Encoding::Raw)
+				{
+					intptr_t item = map.components->Read(entity);
+					if(item == 0)
+						item = PlaceInstance(map, entity);
+					memcpy(reinterpret_cast<void*>(item), section.data + i * section.header.size, section.header.size);
+				}
+				else if(section.header.encoding == Encoding::Serialized)
+				{
+					intptr_t prev = map.components->Read(entity);
+					if(prev != 0)
+						map.mem_pool->Push(prev);
+					map.components->Write(entity, items[i]);
+					if(map.storage == StoragePolicy::Packed)
+						TrackPlacement(map, entity, items[i]);
+				}
+				i++;
+				UpdateSignature(entity, c, true);
+				changes.added.push_back(entity);
+				changes.added_order.push_back(order++);
+			}
+
+			if(iteration == IterationPolicy::Archetype)
+			{
+				moved |= section.removed;
+				moved |= section.changed;
+			}
+		}
+
+		MergeAllChanges();
+		SyncTables();
+		UpdateObservers();
+	}
+
+	/**
+     * @brief Removes empty component pools and deallocates their reserved memory.
+     * Registered, tracked and watched components, components with listeners, and components used by observed queries that are
+     * still referenced, are never removed.
+     * Removes orphaned entities that have no components attached to them, and makes their handles stale.
+     * Optimizes the bitmaps for faster queries and reduced memory consumption.
+     * With 'compact', also moves the instances of every pooled component whose pool holds at least twice as many blocks as
+     * they need into as few blocks as possible, ordered by entity, and releases the other blocks; room for the size hint of
+     * the component (see SetSizeHint) is kept. Pointers to these instances are invalidated.
+     * Should be called infrequently, and only when too many temporary dynamic components were created and deleted.
+     * @param compact true to compact fragmented component pools.
+     */
+	void CleanUp(bool compact = false)
+	{
+		// Orphans are the alive entities that are not in any component
+		vector<const BitMap*> owned;
+		for(auto& map : maps)
+			if(!map.entities.isEmpty())
+				owned.push_back(&map.entities);
+		BitMap orphans = owned.empty() ? alive : alive - BitMap::fastunion(owned.size(), owned.data());
+		if(!orphans.isEmpty())
+			ReleaseEntities(orphans);
+		SyncTables();
+		UpdateObservers();
+		RetainObservers();
+		alive.shrinkToFit();
+
+		vector<size_t> recycled;
+		auto it = index.begin();
+		while(it != index.end())
+		{
+			auto& map = maps[it->second];
+			if(map.entities.cardinality() == 0 && !map.pinned && !map.observed && !map.tracker && !map.events)
+			{
+				recycled.push_back(it->second);
+				component_pool.push_back(it->second);
+				it = index.erase(it);
+				++revision;
+			}
+			else
+			{
+				++it;
+			}
+			map.entities.shrinkToFit();
+		}
+
+		if(!recycled.empty())
+			DropSignatures(recycled);
+
+		if(!compact)
+			return;
+		for(auto& [key, c] : index)
+		{
+			auto& map = maps[c];
+			if(map.storage == StoragePolicy::Pooled && map.mem_pool && map.mem_pool->Fragmented(map.size_hint))
+			{
+				PackComponent(map);
+				size_t live = map.mem_pool->Count();
+				if(map.size_hint > live)
+					map.mem_pool->Reserve(map.size_hint - live);
+				if(iteration == IterationPolicy::Archetype)
+					RefreshColumn(c);
+			}
+		}
+	}
+
+	// Query Parser Adapter Functions
+	virtual size_t Resolve(const string& token) override
+	{
+		return ComponentIndex(token);
+	}
+
+	virtual BitMap Evaluate(size_t id) override
+	{
+		return maps[id].entities;
+	}
+
+	virtual BitMap And(const BitMap& lhs, const BitMap& rhs) override
+	{
+		return lhs & rhs;
+	}
+
+	virtual BitMap Or(const BitMap& lhs, const BitMap& rhs) override
+	{
+		return lhs | rhs;
+	}
+
+	virtual BitMap Not(const BitMap& rhs) override
+	{
+		return alive - rhs;
+	}
+
+	virtual BitMap Changed(size_t id) override
+	{
+		return ChangedEntities(id);
+	}
+
+	virtual BitMap Added(size_t id) override
+	{
+		return AddedEntities(id);
+	}
+
+	virtual BitMap Removed(size_t id) override
 	{
-		auto copy = BitMap(rhs);
-		copy.flip(0, componentRefCount);
-		return copy;
+		return RemovedEntities(id);
 	}
 };
 
@@ -1,60 +1,104 @@
 #pragma once
 
 #include <assert.h>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include <entidy/BlockAllocator.h>
+
 namespace entidy
 {
 using namespace std;
 
+// The memory held by a pool, reported by MemoryManagerImpl::Stats
+struct PoolStats
+{
+	// The number of live items
+	size_t items = 0;
+	size_t blocks = 0;
+	// The number of items that the blocks can hold
+	size_t capacity = 0;
+	// The size of the storage of the blocks, and of the storage carved in advance for the next blocks
+	size_t bytes = 0;
+};
+
 template <typename Type>
 class MemoryPoolImpl;
 
 template <typename Type>
 class MemoryBlock
 {
+public:
+	/**
+     * @brief Storage for a single item. While the item is unused, the slot holds the next unused slot of the free list.
+     */
+	union Slot
+	{
+		Slot* next;
+		std::aligned_storage_t<sizeof(Type), alignof(Type)> item;
+	};
+
 protected:
-	std::aligned_storage_t<sizeof(Type), alignof(Type)>* data;
-	vector<Type*> pool;
+	void* region;
+	Slot* data;
+	Slot* free_list;
+	size_t bump;
+	size_t used;
 	size_t item_capacity;
-	intptr_t start;
-	intptr_t end;
+	bool mapped;
+
+	size_t index = 0;
+	size_t available_index = SIZE_MAX;
 
 	/**
-     * @brief Creates a block and pre-allocates elements of given Type in cache-aligned and contiguous storage.
+     * @brief Creates a block that can hold elements of given Type in cache-aligned and contiguous storage.
+     * The storage is aligned to its own size and starts with a pointer to the block,
+     * so that the owner of any item can be found by masking the address of the item.
+     * Slots are handed out in order the first time, and recycled through a free list threaded through the unused slots,
+     * so no per-item bookkeeping is allocated and creating a block does not touch its items.
      * @param item_capacity The number of items to be allocated in the block.
+     * @param storage The storage of the block, aligned to its size, which is a power of two.
+     * @param is_mapped Whether the storage was mapped from the system by BlockAllocator.
      */
-	MemoryBlock(size_t item_capacity)
+	MemoryBlock(size_t item_capacity, void* storage, bool is_mapped)
+		: region(storage)
+		, free_list(nullptr)
+		, bump(0)
+		, used(0)
+		, item_capacity(item_capacity)
+		, mapped(is_mapped)
 	{
-		this->item_capacity = item_capacity;
-
-		pool.resize(item_capacity);
-
-		data = new std::aligned_storage_t<sizeof(Type), alignof(Type)>[item_capacity];
-
-		Type* pointer = reinterpret_cast<Type*>(data);
-
-		for(size_t i = 0; i < item_capacity; i++)
-		{
-			Type* ptr = pointer + i;
-			pool[i] = ptr;
-		}
-
-		start = (intptr_t)pool[0];
-		end = (intptr_t)pool.back();
+		*reinterpret_cast<MemoryBlock<Type>**>(region) = this;
+		data = reinterpret_cast<Slot*>(reinterpret_cast<char*>(region) + HeaderSize());
 	}
 
 public:
 	/**
-     * @brief Deallocates all the data in the block.
+     * @brief Returns the size of the header that precedes the items in the storage of a block.
+     * @return The header size in bytes.
      */
-	~MemoryBlock()
+	static constexpr size_t HeaderSize()
 	{
-		delete[] data;
+		return ((sizeof(void*) + alignof(Slot) - 1) / alignof(Slot)) * alignof(Slot);
+	}
+
+	/**
+     * @brief Returns the block that owns an item, in constant time.
+     * @param ptr A pointer to an item popped from a block with the same alignment.
+     * @param alignment The size and alignment of the storage of the block.
+     * @return The block that owns 'ptr'.
+     */
+	static MemoryBlock<Type>* Owner(intptr_t ptr, size_t alignment)
+	{
+		return *reinterpret_cast<MemoryBlock<Type>**>(ptr & ~intptr_t(alignment - 1));
 	}
 
 	/**
@@ -72,28 +116,39 @@ public:
      */
 	size_t Available()
 	{
-		return pool.size();
+		return item_capacity - used;
 	}
 
 	/**
-     * @brief Pushes an item to the back of the block.
+     * @brief Pushes the slot of an item that was never constructed, or was already destroyed, to the front of the free list.
      * @param ptr A pointer to the discarded item.
      */
-	void Push(Type* ptr)
+	void Release(Type* ptr)
 	{
-		ptr->~Type();
-		pool.push_back(ptr);
+		Slot* slot = reinterpret_cast<Slot*>(ptr);
+		slot->next = free_list;
+		free_list = slot;
+		--used;
 	}
 
 	/**
-     * @brief Returns and removes an item from the back of the block.
+     * @brief Returns an unused item; recycled items first, then items that were never used.
      * @return A pointer to the requested item.
      */
 	Type* Pop()
 	{
-		Type* back = pool.back();
-		pool.pop_back();
-		return back;
+		Slot* slot;
+		if(free_list != nullptr)
+		{
+			slot = free_list;
+			free_list = slot->next;
+		}
+		else
+		{
+			slot = data + bump++;
+		}
+		++used;
+		return reinterpret_cast<Type*>(slot);
 	}
 
 	/**
@@ -102,7 +157,7 @@ public:
      */
 	intptr_t PointerStart()
 	{
-		return start;
+		return (intptr_t)data;
 	}
 
 	/**
@@ -111,7 +166,7 @@ public:
      */
 	intptr_t PointerEnd()
 	{
-		return end;
+		return (intptr_t)(data + item_capacity - 1);
 	}
 
 	friend MemoryPoolImpl<Type>;
@@ -123,13 +178,87 @@ template <typename Type>
 class MemoryPoolImpl
 {
 protected:
-	vector<MemoryBlock<Type>*> blocks;
+	pmr::memory_resource* resource;
+	pmr::vector<MemoryBlock<Type>*> blocks;
+	pmr::vector<MemoryBlock<Type>*> available;
 	size_t item_capacity;
+	size_t alignment;
+	AllocationPolicy allocation = AllocationPolicy::Heap;
+	int node = AnyNode;
+	BlockAllocator storage;
+
+	MemoryPoolImpl(size_t capacity, pmr::memory_resource* memory)
+		: resource{memory}
+		, blocks{memory}
+		, available{memory}
+		, storage{0, memory}
+	{
+		constexpr size_t header = MemoryBlock<Type>::HeaderSize();
+		constexpr size_t slot = sizeof(typename MemoryBlock<Type>::Slot);
+
+		alignment = 4096;
+		while(alignment < capacity * slot)
+			alignment *= 2;
+		while(alignment - header < slot)
+			alignment *= 2;
+
+		item_capacity = (alignment - header) / slot;
+		storage.Resize(alignment);
+	}
+
+	/**
+     * @brief Allocates an empty block, with its storage from the block allocator, and adds it to the list of blocks.
+     */
+	MemoryBlock<Type>* NewBlock()
+	{
+		bool mapped;
+		void* region = storage.Allocate(allocation, node, mapped);
+		void* place = nullptr;
+		try
+		{
+			blocks.reserve(blocks.size() + 1);
+			place = resource->allocate(sizeof(MemoryBlock<Type>), alignof(MemoryBlock<Type>));
+		}
+		catch(...)
+		{
+			storage.Free(region, mapped);
+			throw;
+		}
+		MemoryBlock<Type>* block = new(place) MemoryBlock<Type>(item_capacity, region, mapped);
+		block->index = blocks.size();
+		blocks.push_back(block);
+		return block;
+	}
 
-	MemoryPoolImpl(size_t capacity)
-		: item_capacity(capacity)
-		, blocks{}
-	{ }
+	/**
+     * @brief De-allocates a block that was removed from the list of blocks.
+     */
+	void DeleteBlock(MemoryBlock<Type>* block)
+	{
+		storage.Free(block->region, block->mapped);
+		block->~MemoryBlock<Type>();
+		resource->deallocate(block, sizeof(MemoryBlock<Type>), alignof(MemoryBlock<Type>));
+	}
+
+	/**
+     * @brief Adds a block to the list of blocks with available items.
+     */
+	void MarkAvailable(MemoryBlock<Type>* block)
+	{
+		block->available_index = available.size();
+		available.push_back(block);
+	}
+
+	/**
+     * @brief Removes a block from the list of blocks with available items.
+     */
+	void UnmarkAvailable(MemoryBlock<Type>* block)
+	{
+		available[block->available_index] = available.back();
+		available[block->available_index]->available_index = block->available_index;
+		available.pop_back();
+		block->available_index = SIZE_MAX;
+	}
 
 public:
 	/**
@@ -138,52 +267,172 @@ public:
 	~MemoryPoolImpl()
 	{
 		for(MemoryBlock<Type>* it : blocks)
-			delete it;
+			DeleteBlock(it);
 	}
 
 	/**
      * @brief Returns an item to the block from which it came.
+     * The owner block is found in constant time from the address of the item.
      * If, after the new item is added the block becomes completely unused, it is de-allocated.
      * @param ptr A pointer to the object being discarded.
      */
 	void Push(intptr_t ptr)
 	{
-		for(size_t i = 0; i < blocks.size(); i++)
-		{
-			MemoryBlock<Type>* block = blocks[i];
-			intptr_t range_start = block->PointerStart();
-			intptr_t range_end = block->PointerEnd();
+		reinterpret_cast<Type*>(ptr)->~Type();
+		Release(ptr);
+	}
 
-			if(ptr >= range_start && ptr <= range_end)
-			{
-				block->Push((Type*)ptr);
-				if(block->Available() == block->Capacity() && blocks.size() > 1)
-				{
-					delete block;
-					blocks[i] = blocks.back();
-					blocks.pop_back();
-				}
-				return;
-			}
+	/**
+     * @brief Returns an item that was never constructed, or was already destroyed, to the block from which it came.
+     * If the block becomes completely unused, it is de-allocated.
+     * @param ptr A pointer to the discarded item.
+     */
+	void Release(intptr_t ptr)
+	{
+		MemoryBlock<Type>* block = MemoryBlock<Type>::Owner(ptr, alignment);
+		assert(ptr >= block->PointerStart() && ptr <= block->PointerEnd());
+
+		block->Release((Type*)ptr);
+		if(block->available_index == SIZE_MAX)
+			MarkAvailable(block);
+
+		if(block->Available() == block->Capacity() && blocks.size() > 1)
+		{
+			UnmarkAvailable(block);
+			blocks[block->index] = blocks.back();
+			blocks[block->index]->index = block->index;
+			blocks.pop_back();
+			DeleteBlock(block);
 		}
 	}
 
 	/**
-     * @brief Returns an item from the first non-empty block managed by the pool.
+     * @brief Returns an item from a non-empty block managed by the pool, in constant time.
      * If no empty blocks are found, a new block is created.
      * @return A pointer to the requested object.
      */
 	Type* Pop()
 	{
-		for(auto& block : blocks)
+		if(available.empty())
 		{
-			if(block->Available() > 0)
-				return block->Pop();
+			MarkAvailable(NewBlock());
+		}
+
+		MemoryBlock<Type>* block = available.back();
+		Type* item = block->Pop();
+		if(block->Available() == 0)
+			UnmarkAvailable(block);
+		return item;
+	}
+
+	/**
+     * @brief Sets how the blocks allocated from now on are allocated.
+     * With AllocationPolicy::HugePages, blocks are enlarged to ENTIDY_HUGE_PAGE_SIZE if the pool has no blocks yet.
+     * @param policy How blocks are allocated.
+     * @param numa_node The NUMA node of the blocks: AnyNode, LocalNode or the number of a node.
+     */
+	void SetAllocation(AllocationPolicy policy, int numa_node)
+	{
+		allocation = policy;
+		node = numa_node;
+		if(policy == AllocationPolicy::HugePages && blocks.empty() && alignment < ENTIDY_HUGE_PAGE_SIZE)
+		{
+			alignment = ENTIDY_HUGE_PAGE_SIZE;
+			item_capacity = (alignment - MemoryBlock<Type>::HeaderSize()) / sizeof(typename MemoryBlock<Type>::Slot);
+			storage.Resize(alignment);
 		}
+	}
+
+	/**
+     * @brief Returns the number of blocks, the number of items they can hold and the size of their storage, in constant time.
+     * @param stats Receives the figures of the pool.
+     */
+	void Stats(PoolStats& stats) const
+	{
+		stats.blocks = blocks.size();
+		stats.capacity = blocks.size() * item_capacity;
+		stats.bytes = (blocks.size() + storage.Spare()) * alignment;
+	}
+
+	/**
+     * @brief Allocates blocks until 'count' items can be popped without allocating.
+     * The pages of the new blocks are touched, so that popping their items does not fault; the first page holds the header.
+     * @param count The number of items.
+     */
+	void Reserve(size_t count)
+	{
+		size_t free = 0;
+		for(MemoryBlock<Type>* block : available)
+			free += block->Available();
 
-		MemoryBlock<Type>* new_block = new MemoryBlock<Type>(item_capacity);
-		blocks.push_back(new_block);
-		return new_block->Pop();
+		while(free < count)
+		{
+			MemoryBlock<Type>* block = NewBlock();
+			for(size_t offset = 4096; offset < alignment; offset += 4096)
+				static_cast<volatile char*>(block->region)[offset] = 0;
+			MarkAvailable(block);
+			free += item_capacity;
+		}
+	}
+
+	/**
+     * @brief Moves the live items into as few fresh blocks as possible, laid out in the given order, and releases the old blocks.
+     * Items are moved with Type's move constructor, and the moved-from items are destroyed.
+     * WARNING: 'items' must contain every live item of the pool; items that are not listed are lost.
+     * @param items Pointers to the live items in the order they should be laid out; replaced by their new locations.
+     */
+	void Compact(vector<intptr_t>& items)
+	{
+		pmr::vector<MemoryBlock<Type>*> old_blocks(resource);
+		old_blocks.swap(blocks);
+		available.clear();
+
+		for(auto& ptr : items)
+		{
+			Type* src = reinterpret_cast<Type*>(ptr);
+			Type* dst = Pop();
+			new(dst) Type(std::move(*src));
+			src->~Type();
+			ptr = (intptr_t)dst;
+		}
+
+		for(MemoryBlock<Type>* block : old_blocks)
+			DeleteBlock(block);
+	}
+
+	/**
+     * @brief Copies contiguous instances into fresh blocks, filled in order, with one copy per block when slots have
+     * the size of Type. Only valid for trivially copyable types.
+     * @param bytes The instances, laid out contiguously.
+     * @param count The number of instances.
+     * @param items Receives the addresses of the new items, in order.
+     */
+	void Adopt(const char* bytes, size_t count, vector<intptr_t>& items)
+	{
+		using Slot = typename MemoryBlock<Type>::Slot;
+
+		items.reserve(items.size() + count);
+		while(count > 0)
+		{
+			MemoryBlock<Type>* block = NewBlock();
+
+			size_t n = min(count, item_capacity);
+			if constexpr(sizeof(Slot) == sizeof(Type))
+				memcpy(block->data, bytes, n * sizeof(Type));
+			else
+				for(size_t i = 0; i < n; i++)
+					memcpy(block->data + i, bytes + i * sizeof(Type), sizeof(Type));
+
+			for(size_t i = 0; i < n; i++)
+				items.push_back(intptr_t(block->data + i));
+			block->bump = n;
+			block->used = n;
+			if(block->Available() > 0)
+				MarkAvailable(block);
+
+			bytes += n * sizeof(Type);
+			count -= n;
+		}
 	}
 
 	friend MemoryManagerImpl;
@@ -197,6 +446,15 @@ class MemoryManagerImpl
 protected:
 	shared_ptr<void> pool;
 	std::function<void(MemoryManagerImpl* sender, intptr_t ptr)> push;
+	std::function<void(MemoryManagerImpl* sender, intptr_t ptr)> release;
+	std::function<intptr_t(MemoryManagerImpl* sender)> pop;
+	std::function<size_t(const MemoryManagerImpl* sender)> blocks;
+	std::function<void(const MemoryManagerImpl* sender, PoolStats& stats)> stats;
+	std::function<bool(MemoryManagerImpl* sender, vector<intptr_t>& items)> compact;
+	std::function<bool(MemoryManagerImpl* sender, const char* bytes, size_t count, vector<intptr_t>& items)> adopt;
+	std::function<void(MemoryManagerImpl* sender, size_t count)> reserve;
+	std::function<void(MemoryManagerImpl* sender, AllocationPolicy policy, int node)> allocation;
+	pmr::memory_resource* resource = nullptr;
 	size_t counter = 0;
 
 public:
@@ -204,27 +462,171 @@ public:
      * @brief Creates a new pool that managed memory blocks of objects of a given Type.
      * @tparam Type of the requested object pool.
      * @param size_hint Optional hint to set the number of items per block.
+     * @param memory The memory resource that allocates the blocks, which must outlive the pool; the default resource if null.
      * @return A memory manager object that manages the pool of objects of type Type.
      */
 	template <typename Type>
-	static shared_ptr<MemoryManagerImpl> Create(size_t size_hint = 0)
+	static shared_ptr<MemoryManagerImpl> Create(size_t size_hint = 0, pmr::memory_resource* memory = nullptr)
 	{
+		if(memory == nullptr)
+			memory = pmr::get_default_resource();
+
 		size_t maxc = size_t(4 * 1024 * 1024) / sizeof(Type);
 		size_t defc = size_hint == 0 ? size_t(2 * 1024 * 1024) / sizeof(Type) : size_hint;
 
 		size_t block_capacity = max(size_t(1), min(defc, maxc));
 
 		shared_ptr<MemoryManagerImpl> managed_pool(new MemoryManagerImpl());
-		managed_pool->pool = shared_ptr<MemoryPoolImpl<Type>>(new MemoryPoolImpl<Type>(block_capacity));
+		managed_pool->resource = memory;
+		managed_pool->pool = shared_ptr<MemoryPoolImpl<Type>>(new MemoryPoolImpl<Type>(block_capacity, memory));
 		managed_pool->push = [&](MemoryManagerImpl* sender, intptr_t ptr) {
 			MemoryPoolImpl<Type>* mp = static_cast<MemoryPoolImpl<Type>*>(sender->pool.get());
 			mp->Push(ptr);
 		};
+		managed_pool->release = [](MemoryManagerImpl* sender, intptr_t ptr) {
+			static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->Release(ptr);
+		};
+		managed_pool->pop = [](MemoryManagerImpl* sender) {
+			return (intptr_t) static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->Pop();
+		};
+		managed_pool->blocks = [](const MemoryManagerImpl* sender) {
+			return static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->blocks.size();
+		};
+		managed_pool->stats = [](const MemoryManagerImpl* sender, PoolStats& stats) {
+			static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->Stats(stats);
+		};
+		managed_pool->compact = [](MemoryManagerImpl* sender, vector<intptr_t>& items) {
+			if constexpr(is_move_constructible_v<Type>)
+			{
+				static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->Compact(items);
+				return true;
+			}
+			return false;
+		};
+		managed_pool->adopt = [](MemoryManagerImpl* sender, const char* bytes, size_t count, vector<intptr_t>& items) {
+			if constexpr(is_trivially_copyable_v<Type>)
+			{
+				static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->Adopt(bytes, count, items);
+				return true;
+			}
+			return false;
+		};
+		managed_pool->reserve = [](MemoryManagerImpl* sender, size_t count) {
+			static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->Reserve(count);
+		};
+		managed_pool->allocation = [](MemoryManagerImpl* sender, AllocationPolicy policy, int node) {
+			static_cast<MemoryPoolImpl<Type>*>(sender->pool.get())->SetAllocation(policy, node);
+		};
 		return managed_pool;
 	}
 
 	~MemoryManagerImpl() { }
 
+	/**
+     * @brief Returns the memory resource that allocates the blocks of the pool.
+     */
+	pmr::memory_resource* Resource() const
+	{
+		return resource;
+	}
+
+	/**
+     * @brief Returns the number of memory blocks currently allocated by the pool.
+     * @return The number of blocks.
+     */
+	size_t Blocks() const
+	{
+		return blocks(this);
+	}
+
+	/**
+     * @brief Returns the number of items popped from the pool and not pushed back yet.
+     * @return The number of live items.
+     */
+	size_t Count() const
+	{
+		return counter;
+	}
+
+	/**
+     * @brief Returns the live items, blocks, capacity and storage size of the pool, in constant time.
+     * @return The figures of the pool.
+     */
+	PoolStats Stats() const
+	{
+		PoolStats result;
+		stats(this, result);
+		result.items = counter;
+		return result;
+	}
+
+	/**
+     * @brief Returns whether the pool holds at least twice as many blocks as its live items need, which happens when items
+     * are pushed back to blocks that still hold a few others: only completely unused blocks are released by Push.
+     * A spare block or two, e.g. left by Reserve, is not fragmentation.
+     * @param reserved The number of items the pool should keep room for after compaction, such as a size hint.
+     * @return true if compacting the pool would release at least half of its blocks.
+     */
+	bool Fragmented(size_t reserved = 0) const
+	{
+		PoolStats current = Stats();
+		if(current.blocks < 2)
+			return false;
+		size_t per_block = current.capacity / current.blocks;
+		size_t needed = (max(current.items, reserved) + per_block - 1) / per_block;
+		return current.blocks >= 2 * max(needed, size_t(1));
+	}
+
+	/**
+     * @brief Sets how the memory blocks of the pool are allocated from now on: from its memory resource, or mapped with huge
+     * pages, and on which NUMA node. Blocks that cannot be allocated as requested are allocated from the memory resource.
+     * Should be called before the first item is popped, so that blocks can be sized for huge pages.
+     * @param policy How blocks are allocated.
+     * @param node The NUMA node of the blocks: AnyNode, LocalNode or the number of a node.
+     */
+	void SetAllocation(AllocationPolicy policy, int node = AnyNode)
+	{
+		allocation(this, policy, node);
+	}
+
+	/**
+     * @brief Allocates blocks in advance, so that 'count' more items can be popped without allocating.
+     * Blocks that become unused are still released by Push.
+     * @param count The number of items.
+     */
+	void Reserve(size_t count)
+	{
+		reserve(this, count);
+	}
+
+	/**
+     * @brief Moves all the live items into as few blocks as possible, in the given order, and releases the freed blocks.
+     * Does nothing if the pooled type is not move-constructible.
+     * WARNING: 'items' must contain every live item of the pool; items that are not listed are lost.
+     * @param items Pointers to the live items in the order they should be laid out; replaced by their new locations.
+     * @return true if the items were moved, false otherwise.
+     */
+	bool Compact(vector<intptr_t>& items)
+	{
+		return compact(this, items);
+	}
+
+	/**
+     * @brief Copies contiguous instances into new blocks, in bulk.
+     * Does nothing if the pooled type is not trivially copyable.
+     * @param bytes The instances, laid out contiguously.
+     * @param count The number of instances.
+     * @param items Receives the addresses of the new items, in order.
+     * @return true if the instances were copied, false otherwise.
+     */
+	bool Adopt(const char* bytes, size_t count, vector<intptr_t>& items)
+	{
+		if(!adopt(this, bytes, count, items))
+			return false;
+		counter += count;
+		return true;
+	}
+
 	/**
      * @brief Returns a single item back to the pool.
      * If a block is unused, it is de-allocated.
@@ -236,6 +638,17 @@ public:
 		counter--;
 	}
 
+	/**
+     * @brief Returns a single item back to the pool without destroying it, for items that were popped but never constructed.
+     * If a block is unused, it is de-allocated.
+     * @param ptr A pointer to the discarded item.
+     */
+	void Release(intptr_t ptr)
+	{
+		release(this, ptr);
+		counter--;
+	}
+
 	/**
      * @brief Pops a single item from the pool.
      * If all blocks are used, creates a new block.
@@ -250,5 +663,16 @@ public:
 		MemoryPoolImpl<Type>* mempool = static_cast<MemoryPoolImpl<Type>*>(pool.get());
 		return mempool->Pop();
 	}
+
+	/**
+     * @brief Pops a single item from the pool, without knowing its type.
+     * If all blocks are used, creates a new block.
+     * @return A pointer to the uninitialized item popped from the pool.
+     */
+	intptr_t Pop()
+	{
+		counter++;
+		return pop(this);
+	}
 };
 } // namespace entidy
@@ -16,6 +16,115 @@ namespace entidy
 using namespace std;
 
 class Entidy;
+class Query;
+
+class Observer
+{
+protected:
+	Indexer indexer;
+	shared_ptr<ObservedQuery> observed;
+
+	Observer(Indexer idxer, const vector<string>& select_keys, const string& filter_string)
+		: indexer(idxer)
+		, observed(idxer->Observe(idxer->ComponentIndices(select_keys), idxer->Compile(filter_string)))
+	{ }
+
+public:
+	/**
+     * @brief Returns the entities that matched the query at the last commit.
+     * The result is updated by every commit from the entities whose components changed, instead of being evaluated again.
+     * The returned bitmap is updated in place: it must not be read while a commit runs, and must be copied to keep the
+     * result of a given commit.
+     * @return The indices of the matching entities.
+     */
+	const BitMap& Entities() const
+	{
+		return observed->entities;
+	}
+
+	/**
+     * @brief Returns the number of entities that matched the query at the last commit.
+     * @return The number of matching entities.
+     */
+	size_t Size() const
+	{
+		return observed->entities.cardinality();
+	}
+
+	/**
+     * @brief Returns a view over the entities that matched the query at the last commit, and the selected components.
+     * No filter is evaluated; the view is made from a copy of the result.
+     * @return A View with lists of pointers to the requested components.
+     */
+	View Execute() const
+	{
+		return indexer->Fetch(observed->keys, observed->entities);
+	}
+
+	friend Query;
+};
+
+class CompiledQuery
+{
+protected:
+	Indexer indexer;
+	vector<string> select;
+	string filter;
+
+	vector<size_t> keys;
+	Token plan;
+	size_t revision;
+
+	// The signatures that matched, and the number of signatures checked, with IterationPolicy::Archetype
+	vector<size_t> archetypes;
+	size_t checked = 0;
+
+	CompiledQuery(Indexer idxer, const vector<string>& select_keys, const string& filter_string)
+		: indexer(idxer)
+		, select(select_keys)
+		, filter(filter_string)
+	{
+		Compile();
+	}
+
+	/**
+     * @brief Resolves the selected keys and the filter string into component indices.
+     * @throw EntidyException if the filter string has a syntax error or is empty.
+     */
+	void Compile()
+	{
+		plan = indexer->Compile(filter);
+		keys = indexer->ComponentIndices(select);
+		revision = indexer->Revision();
+		archetypes.clear();
+		checked = 0;
+	}
+
+public:
+	/**
+     * @brief Executes the pre-compiled query and returns a view with lists of pointers to the selected components.
+     * The filter is not parsed again and no key lookups are performed,
+     * unless component indices were recycled by a CleanUp since the query was compiled.
+     * With IterationPolicy::Archetype, the query is matched against the signatures created since it was last executed,
+     * and the view iterates over the tables of the matching signatures, without evaluating any bitmaps.
+     * Filters that use predicates such as Changed are always evaluated on the bitmaps.
+     * @return A View with lists of pointers to the requested components.
+     */
+	View Execute()
+	{
+		if(revision != indexer->Revision())
+			Compile();
+
+		if(indexer->Iteration() == IterationPolicy::Archetype && indexer->Structural(plan))
+		{
+			indexer->MatchSignatures(keys, plan, archetypes, checked);
+			return indexer->FetchArchetypes(keys, archetypes);
+		}
+		return indexer->Fetch(keys, plan);
+	}
+
+	friend Query;
+};
 
 class Query
 {
@@ -43,6 +152,36 @@ public:
 		return indexer->Fetch(select, filter);
 	}
 
+	/**
+     * @brief Parses the filter and resolves all component keys once, returning a query that can be executed repeatedly.
+     * @param filter Query string used to filter the entities.
+     * @return A CompiledQuery for the selected components and filter.
+     * @throw EntidyException if the filter string has a syntax error or is empty.
+     * @example
+     * auto query = entidy.Select({"Position", "Velocity"}).Compile("Position & Velocity");
+     * query.Execute().Each([&](Entity e, Vec2f* position, Vec2f* velocity){ // ... });
+     */
+	CompiledQuery Compile(const string& filter)
+	{
+		return CompiledQuery(indexer, select, filter);
+	}
+
+	/**
+     * @brief Creates a query whose result is kept up to date by every commit, in proportion to the entities that changed.
+     * The selected components and the components in the filter are never recycled by CleanUp.
+     * Intended for queries that are run every frame and whose results change little between frames.
+     * @param filter Query string used to filter the entities.
+     * @return An Observer for the selected components and filter, updated until it is destroyed.
+     * @throw EntidyException if the filter string has a syntax error or is empty, or uses predicates such as Changed.
+     * @example
+     * auto sprites = entidy.Select({"Sprite", "Position"}).Observe("Sprite & Position");
+     * sprites.Execute().Each([&](Entity e, Sprite* sprite, Vec2f* position){ // ... });
+     */
+	Observer Observe(const string& filter)
+	{
+		return Observer(indexer, select, filter);
+	}
+
 	friend Entidy;
 };
 
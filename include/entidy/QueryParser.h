@@ -1,5 +1,6 @@
 #pragma once
 #include <deque>
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -13,10 +14,14 @@ template <typename Type>
 class QueryParserAdapter
 {
 public:
-	virtual Type Evaluate(const string& token) = 0;
+	virtual size_t Resolve(const string& token) = 0;
+	virtual Type Evaluate(size_t id) = 0;
 	virtual Type And(const Type& lhs, const Type& rhs) = 0;
 	virtual Type Or(const Type& lhs, const Type& rhs) = 0;
 	virtual Type Not(const Type& rhs) = 0;
+	virtual Type Changed(size_t id) = 0;
+	virtual Type Added(size_t id) = 0;
+	virtual Type Removed(size_t id) = 0;
 };
 
 enum class TokenType
@@ -25,6 +30,9 @@ enum class TokenType
 	And,
 	Or,
 	Not,
+	Changed,
+	Added,
+	Removed,
 	BlockStart,
 	BlockEnd,
 	Leaf
@@ -36,17 +44,20 @@ public:
 	string key;
 	TokenType op;
 	vector<Token> children;
+	size_t id;
 
 	Token()
 		: op(TokenType::Nil)
 		, key{}
 		, children{}
+		, id{0}
 	{ }
 
 	explicit Token(const string& key)
 		: op(Parse(key))
 		, key{}
 		, children{}
+		, id{0}
 	{ }
 
 	/**
@@ -73,9 +84,47 @@ public:
 			return TokenType::Leaf;
 	}
 
+	/**
+     * @brief Translate the name of a predicate on a component, e.g Changed in Changed(Position), into its TokenType enum.
+     * @return enum TokenType, or NIL (error) if the predicate does not exist.
+     */
+	static TokenType ParsePredicate(const string& key)
+	{
+		if(key == "Changed")
+			return TokenType::Changed;
+		else if(key == "Added")
+			return TokenType::Added;
+		else if(key == "Removed")
+			return TokenType::Removed;
+		return TokenType::Nil;
+	}
+
+	/**
+     * @brief Checks whether the token is a predicate on a component, such as Changed.
+     * @return true if the token is a predicate, false otherwise.
+     */
+	bool Predicate() const
+	{
+		return op == TokenType::Changed || op == TokenType::Added || op == TokenType::Removed;
+	}
+
+	/**
+     * @brief Checks whether a branch contains predicates.
+     * @return true if the token or any of its descendants is a predicate, false otherwise.
+     */
+	bool ContainsPredicate() const
+	{
+		if(Predicate())
+			return true;
+		for(auto& child : children)
+			if(child.ContainsPredicate())
+				return true;
+		return false;
+	}
+
 	/**
      * @brief Internal function used for expression tree construction.
-     * A token is valid if it can be evaluated, i.e has 2 children if its AND and OR, 1 if NOT, etc..
+     * A token is valid if it can be evaluated, i.e has at least 2 children if its AND and OR, 1 if NOT, etc..
      * @return true if valid, false otherwise.
      */
 	bool Valid()
@@ -84,15 +133,22 @@ public:
 		{
 		case TokenType::And:
 		case TokenType::Or: {
-			if(children.size() != 2)
+			if(children.size() < 2)
 				return false;
-			return children[0].Valid() && children[1].Valid();
+			for(auto& child : children)
+				if(!child.Valid())
+					return false;
+			return true;
 		}
 		case TokenType::Not: {
 			if(children.size() != 1)
 				return false;
 			return children[0].Valid();
 		}
+		case TokenType::Changed:
+		case TokenType::Added:
+		case TokenType::Removed:
+			return children.size() == 1 && children[0].op == TokenType::Leaf;
 		case TokenType::Leaf:
 			return true;
 		};
@@ -101,26 +157,75 @@ public:
 	}
 
 	/**
-     * @brief Evaluates a branch in the tree and calls the appropriate evaluation functions on the adapter.
+     * @brief Merges chains of the same operator into a single n-ary operation, e.g (A & B) & C into &(A, B, C).
+     * Lets the evaluator order all the operands of a chain at once.
+     */
+	void Flatten()
+	{
+		for(auto& child : children)
+			child.Flatten();
+
+		if(op != TokenType::And && op != TokenType::Or)
+			return;
+
+		vector<Token> flat;
+		for(auto& child : children)
+		{
+			if(child.op == op)
+				flat.insert(flat.end(), std::make_move_iterator(child.children.begin()), std::make_move_iterator(child.children.end()));
+			else
+				flat.push_back(std::move(child));
+		}
+		children = std::move(flat);
+	}
+
+	/**
+     * @brief Resolves the keys of all the leaves in a branch into ids, so that the branch can be evaluated repeatedly without string lookups.
      * @tparam Type of the evaluation objects (e.g Bitset or Bitmap objects).
      * @param adapter A pointer to a QueryParserAdapter.
-     * @return The result of the evaluation.
      */
 	template <typename Type>
-	Type Evaluate(QueryParserAdapter<Type>* adapter)
+	void Resolve(QueryParserAdapter<Type>* adapter)
 	{
 		if(op == TokenType::Leaf)
-			return adapter->Evaluate(key);
+			id = adapter->Resolve(key);
 
-		if(op == TokenType::And)
-			return adapter->And(children[0].Evaluate(adapter), children[1].Evaluate(adapter));
+		for(auto& child : children)
+			child.Resolve(adapter);
+	}
+
+	/**
+     * @brief Evaluates a resolved branch in the tree and calls the appropriate evaluation functions on the adapter.
+     * @tparam Type of the evaluation objects (e.g Bitset or Bitmap objects).
+     * @param adapter A pointer to a QueryParserAdapter.
+     * @return The result of the evaluation.
+     */
+	template <typename Type>
+	Type Evaluate(QueryParserAdapter<Type>* adapter) const
+	{
+		if(op == TokenType::Leaf)
+			return adapter->Evaluate(id);
 
-		if(op == TokenType::Or)
-			return adapter->Or(children[0].Evaluate(adapter), children[1].Evaluate(adapter));
+		if(op == TokenType::And || op == TokenType::Or)
+		{
+			Type result = children[0].Evaluate(adapter);
+			for(size_t k = 1; k < children.size(); k++)
+				result = op == TokenType::And ? adapter->And(result, children[k].Evaluate(adapter)) : adapter->Or(result, children[k].Evaluate(adapter));
+			return result;
+		}
 
 		if(op == TokenType::Not)
 			return adapter->Not(children[0].Evaluate(adapter));
 
+		if(op == TokenType::Changed)
+			return adapter->Changed(children[0].id);
+
+		if(op == TokenType::Added)
+			return adapter->Added(children[0].id);
+
+		if(op == TokenType::Removed)
+			return adapter->Removed(children[0].id);
+
 		throw EntidyException("Bad Token: " + key);
 	}
 };
@@ -134,6 +239,7 @@ protected:
 	/**
      * @brief Splits a query string into invidual tokens.
      * Separators are: empty space, &, |, !, ) and (
+     * Keys directly followed by ( are predicates.
      * @return deque of Tokens.
      */
 	deque<Token> Tokenize(const string& query)
@@ -156,11 +262,15 @@ protected:
 			string key = query.substr(prev, pos - prev);
 			prev = pos;
 			tokens.push_back(Token(key));
+
+			// A key followed by a parenthesis is a predicate on a component, e.g Changed(Position) or Added(Sprite)
+			size_t next = query.find_first_not_of(' ', pos);
+			if(next != std::string::npos && query[next] == '(')
+				tokens.back().op = Token::ParsePredicate(key);
 		}
 
-		string key = query.substr(prev, query.size());
-		//if(tokens.size() == 0)
-		tokens.push_back(Token(key));
+		if(prev < query.size())
+			tokens.push_back(Token(query.substr(prev)));
 
 		return tokens;
 	}
@@ -207,8 +317,8 @@ protected:
 	}
 
 	/**
-     * @brief Combines and removes Not tokens.
-     * @return false if no Not tokens were found, true otherwise.
+     * @brief Combines and removes Not tokens, and predicates with the component they apply to.
+     * @return false if no Not tokens or predicates were found, true otherwise.
      */
 	bool ParseNot(deque<Token>& tokens)
 	{
@@ -218,7 +328,8 @@ protected:
 			auto& prev = it;
 			auto cur = it + 1;
 
-			if(prev->op == TokenType::Not && cur->Valid() && !prev->Valid())
+			bool unary = prev->op == TokenType::Not || (prev->Predicate() && cur->op == TokenType::Leaf);
+			if(unary && cur->Valid() && !prev->Valid())
 			{
 				prev->children.push_back(*cur);
 				tokens.erase(cur);
@@ -307,18 +418,32 @@ public:
 	}
 
 	/**
-     * @brief Combines and removes Not tokens.
+     * @brief Builds the expression tree of a query, flattens its chains of AND and OR, and resolves its leaves, without evaluating it.
+     * The returned tree can be evaluated any number of times with Token::Evaluate.
      * @param query A query string.
-     * @return The result of executing the query.
-     * @throws EntidyException if the query syntax is wrong, or the evaluation of expressions failed.
+     * @return The root of the resolved expression tree.
+     * @throws EntidyException if the query syntax is wrong.
      */
-	Type Parse(const string& query)
+	Token Compile(const string& query)
 	{
 		auto tokens = Tokenize(query);
-		if(!BuildTree(tokens))
+		if(!BuildTree(tokens) || !tokens.front().Valid())
 			throw EntidyException("Bad Query; Check syntax: " + query);
 
-		return tokens.front().Evaluate(adapter);
+		tokens.front().Flatten();
+		tokens.front().Resolve(adapter);
+		return tokens.front();
+	}
+
+	/**
+     * @brief Compiles and evaluates a query.
+     * @param query A query string.
+     * @return The result of executing the query.
+     * @throws EntidyException if the query syntax is wrong, or the evaluation of expressions failed.
+     */
+	Type Parse(const string& query)
+	{
+		return Compile(query).Evaluate(adapter);
 	}
 };
 
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <entidy/Exception.h>
+
+#ifndef ENTIDY_SNAPSHOT_MMAP
+#	if defined(__unix__) || defined(__APPLE__)
+#		define ENTIDY_SNAPSHOT_MMAP 1
+#	else
+#		define ENTIDY_SNAPSHOT_MMAP 0
+#	endif
+#endif
+
+#if ENTIDY_SNAPSHOT_MMAP
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+// Alignment of the raw sections of component instances within a snapshot file
+#ifndef ENTIDY_SNAPSHOT_ALIGNMENT
+#	define ENTIDY_SNAPSHOT_ALIGNMENT 64
+#endif
+
+namespace entidy
+{
+using namespace std;
+
+/**
+ * @brief Saves and loads the instances of a component type for Entidy::Save and Entidy::Load.
+ * Trivially copyable types are saved as raw bytes and need no serializer.
+ * Other types must specialize Serializer with two static functions, that write and read an instance in any format:
+ * @example
+ * template <>
+ * struct entidy::Serializer<Name>
+ * {
+ *     static void Save(ostream& out, const Name& name);
+ *     static Name Load(istream& in);
+ * };
+ */
+template <typename Type>
+struct Serializer
+{ };
+
+template <typename Type, typename = void>
+struct HasSerializer : false_type
+{ };
+
+template <typename Type>
+struct HasSerializer<Type, void_t<decltype(Serializer<Type>::Save(declval<ostream&>(), declval<const Type&>())), decltype(Serializer<Type>::Load(declval<istream&>()))>>
+	: true_type
+{ };
+
+// How the instances of a component are stored in a snapshot.
+// None: the component is a flag, or its type cannot be saved.
+// Raw: the bytes of the instances, contiguous and ordered by entity.
+// Serialized: the output of Serializer<Type> for every instance, ordered by entity.
+enum class Encoding : uint32_t
+{
+	None,
+	Raw,
+	Serialized
+};
+
+class ComponentCodecImpl;
+using ComponentCodec = shared_ptr<ComponentCodecImpl>;
+
+/**
+ * @brief Saves and loads the instances of a component, without knowing their type.
+ */
+class ComponentCodecImpl
+{
+protected:
+	size_t size = 0;
+	Encoding encoding = Encoding::None;
+	std::function<void(ostream& out, intptr_t item)> save;
+	std::function<void(istream& in, intptr_t place)> load;
+
+public:
+	/**
+     * @brief Creates the codec of a component type: raw bytes if it is trivially copyable, Serializer<Type> if it is specialized.
+     * Specialized serializers take precedence over raw bytes. Types that have neither cannot be saved.
+     * @tparam Type The component type.
+     * @return The codec.
+     */
+	template <typename Type>
+	static ComponentCodec Create()
+	{
+		ComponentCodec codec = make_shared<ComponentCodecImpl>();
+		codec->size = sizeof(Type);
+
+		if constexpr(HasSerializer<Type>::value)
+		{
+			codec->encoding = Encoding::Serialized;
+			codec->save = [](ostream& out, intptr_t item) { Serializer<Type>::Save(out, *reinterpret_cast<const Type*>(item)); };
+			codec->load = [](istream& in, intptr_t place) { new(reinterpret_cast<void*>(place)) Type(Serializer<Type>::Load(in)); };
+		}
+		else if constexpr(is_trivially_copyable_v<Type>)
+		{
+			codec->encoding = Encoding::Raw;
+			codec->save = [](ostream& out, intptr_t item) { out.write(reinterpret_cast<const char*>(item), sizeof(Type)); };
+		}
+		return codec;
+	}
+
+	/**
+     * @brief Returns the size of an instance, in bytes.
+     */
+	size_t Size() const
+	{
+		return size;
+	}
+
+	/**
+     * @brief Returns how instances are stored in a snapshot; Encoding::None if they cannot be saved.
+     */
+	Encoding GetEncoding() const
+	{
+		return encoding;
+	}
+
+	/**
+     * @brief Writes an instance.
+     */
+	void Save(ostream& out, intptr_t item) const
+	{
+		save(out, item);
+	}
+
+	/**
+     * @brief Reads a serialized instance and constructs it at 'place'.
+     * Raw instances are copied in bulk by MemoryManagerImpl::Adopt instead.
+     */
+	void Load(istream& in, intptr_t place) const
+	{
+		load(in, place);
+	}
+};
+
+// The header of a snapshot file, followed by the alive entities and their generations.
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t generation_bits;
+	uint32_t entities;
+	uint32_t components;
+};
+
+// The header of a component within a snapshot file, followed by its key, its entities and the data of its instances.
+struct SnapshotComponent
+{
+	uint64_t type;
+	uint64_t bitmap;
+	uint64_t data;
+	uint32_t key;
+	uint32_t size;
+	Encoding encoding;
+	uint32_t reserved;
+};
+
+/**
+ * @brief Writes a snapshot or a delta to a stream, keeping track of the position to align sections.
+ */
+class SnapshotWriter
+{
+protected:
+	ostream& out;
+	uint64_t position = 0;
+
+public:
+	explicit SnapshotWriter(ostream& stream)
+		: out(stream)
+	{ }
+
+	/**
+     * @brief Writes 'size' bytes.
+     */
+	void Write(const void* data, size_t size)
+	{
+		out.write(reinterpret_cast<const char*>(data), size);
+		position += size;
+	}
+
+	/**
+     * @brief Writes zeros up to the next multiple of 'alignment'.
+     */
+	void Align(size_t alignment)
+	{
+		static const char zeros[ENTIDY_SNAPSHOT_ALIGNMENT] = {};
+		size_t padding = size_t((alignment - position % alignment) % alignment);
+		Write(zeros, padding);
+	}
+
+	/**
+     * @brief Flushes the stream.
+     * @throw EntidyException if any write failed.
+     */
+	void Flush()
+	{
+		out.flush();
+		if(!out)
+			throw(EntidyException("Cannot write snapshot"));
+	}
+};
+
+/**
+ * @brief Reads a snapshot file, mapped in memory where supported and read in one go otherwise, or a delta in memory.
+ * Sections are returned as pointers into the file; nothing is copied until the instances are adopted by the memory pools.
+ */
+class SnapshotReader
+{
+protected:
+	const char* data = nullptr;
+	size_t size = 0;
+	size_t position = 0;
+	vector<char> buffer;
+#if ENTIDY_SNAPSHOT_MMAP
+	void* mapping = nullptr;
+#endif
+
+	// A read-only stream over a section of the file, for serialized instances
+	struct SectionBuffer : streambuf
+	{
+		SectionBuffer(const char* begin, size_t length)
+		{
+			char* first = const_cast<char*>(begin);
+			setg(first, first, first + length);
+		}
+	};
+
+public:
+	/**
+     * @throw EntidyException if the file cannot be read.
+     */
+	explicit SnapshotReader(const string& path)
+	{
+#if ENTIDY_SNAPSHOT_MMAP
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw(EntidyException("Cannot read snapshot " + path));
+		struct stat info;
+		if(fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if(mapping == MAP_FAILED)
+				mapping = nullptr;
+			else
+				size = size_t(info.st_size);
+		}
+		close(fd);
+		if(mapping != nullptr)
+		{
+			data = static_cast<const char*>(mapping);
+			return;
+		}
+#endif
+		ifstream in(path, ios::binary | ios::ate);
+		if(!in)
+			throw(EntidyException("Cannot read snapshot " + path));
+		buffer.resize(size_t(in.tellg()));
+		in.seekg(0);
+		in.read(buffer.data(), buffer.size());
+		if(!in)
+			throw(EntidyException("Cannot read snapshot " + path));
+		data = buffer.data();
+		size = buffer.size();
+	}
+
+	/**
+     * @brief Reads from bytes in memory, which must outlive the reader.
+     */
+	SnapshotReader(const char* bytes, size_t length)
+		: data(bytes)
+		, size(length)
+	{ }
+
+	SnapshotReader(const SnapshotReader&) = delete;
+	SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+	~SnapshotReader()
+	{
+#if ENTIDY_SNAPSHOT_MMAP
+		if(mapping != nullptr)
+			munmap(mapping, size);
+#endif
+	}
+
+	/**
+     * @brief Returns the next 'length' bytes and moves past them.
+     * @throw EntidyException if the file is too short.
+     */
+	const char* Read(size_t length)
+	{
+		if(length > size - position)
+			throw(EntidyException("Corrupted snapshot: unexpected end of file"));
+		const char* section = data + position;
+		position += length;
+		return section;
+	}
+
+	/**
+     * @brief Reads a trivially copyable value.
+     * @throw EntidyException if the file is too short.
+     */
+	template <typename Type>
+	Type Read()
+	{
+		Type value;
+		memcpy(&value, Read(sizeof(Type)), sizeof(Type));
+		return value;
+	}
+
+	/**
+     * @brief Skips the padding up to the next multiple of 'alignment'.
+     */
+	void Align(size_t alignment)
+	{
+		Read((alignment - position % alignment) % alignment);
+	}
+
+	/**
+     * @brief Reads serialized instances from a section, which must be fully consumed.
+     * @param section The section, returned by Read.
+     * @param length The length of the section.
+     * @param fn Called with an input stream over the section.
+     * @throw EntidyException if the section is not fully consumed, or a read fails.
+     */
+	template <typename F>
+	static void Parse(const char* section, size_t length, F&& fn)
+	{
+		SectionBuffer buf(section, length);
+		istream in(&buf);
+		in.exceptions(ios::failbit | ios::badbit);
+		try
+		{
+			fn(in);
+		}
+		catch(const ios::failure&)
+		{
+			throw(EntidyException("Corrupted snapshot: serialized instances are truncated"));
+		}
+		if(in.peek() != char_traits<char>::eof())
+			throw(EntidyException("Corrupted snapshot: serialized instances are too long"));
+	}
+};
+
+} // namespace entidy
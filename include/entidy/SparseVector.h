@@ -3,6 +3,7 @@
 #include <array>
 #include <cmath>
 #include <memory>
+#include <memory_resource>
 #include <string>
 
 #include <entidy/Exception.h>
@@ -34,9 +35,12 @@ template <size_t PageSize>
 class SparseVectorImpl
 {
 protected:
-	vector<Page<PageSize>*> pages;
+	// Allocated from the memory resource of the memory manager, like the pages themselves
+	pmr::vector<Page<PageSize>*> pages;
 	MemoryManager memory_manager;
 	size_t size;
+	// The number of allocated pages
+	size_t page_count = 0;
 
 	/**
      * @brief Returns a recycled or created page from the memory pool.
@@ -46,13 +50,14 @@ protected:
 	{
 		Page<PageSize>* page = memory_manager->Pop<Page<PageSize>>();
 		new(page) Page<PageSize>();
+		page_count++;
 		return page;
 	}
 
 public:
 	SparseVectorImpl(MemoryManager manager)
-		: memory_manager(manager)
-		, pages{}
+		: pages{manager->Resource()}
+		, memory_manager(manager)
 		, size{0}
 	{ }
 
@@ -84,6 +89,17 @@ public:
 		return pages[page_index]->data[block_index];
 	}
 
+	/**
+     * @brief Returns the page at index 'page_index', used for reading consecutive indices without repeated lookups.
+     * @return A pointer to the page, or nullptr if the page does not exist.
+     */
+	const Page<PageSize>* GetPage(size_t page_index) const
+	{
+		if(page_index >= pages.size())
+			return nullptr;
+		return pages[page_index];
+	}
+
 	/**
      * @brief Writes or replaces value 'value' at index 'index'. Creates page if it doesn't exist.
      * If 'value' is 0, no page is created.
@@ -143,11 +159,24 @@ public:
 		{
 			memory_manager->Push((intptr_t)(pages[page_index]));
 			pages[page_index] = nullptr;
+			page_count--;
 		}
 
 		return prev;
 	}
 
+	/**
+     * @brief Sizes the list of pages for indices up to 'count', so that writing to them does not grow it.
+     * Pages themselves are still created on first write.
+     * @param count The number of indices.
+     */
+	void Reserve(size_t count)
+	{
+		size_t needed = (count + PageSize - 1) / PageSize;
+		if(pages.size() < needed)
+			pages.resize(needed, nullptr);
+	}
+
 	/**
      * @brief Returns total number of non-zero items in SparseVector.
      * @return Total number of non-zero items in SparseVector.
@@ -156,6 +185,15 @@ public:
 	{
 		return size;
 	}
+
+	/**
+     * @brief Returns the number of pages currently allocated, each holding PageSize values.
+     * @return The number of pages.
+     */
+	size_t Pages() const
+	{
+		return page_count;
+	}
 };
 
 } // namespace entidy
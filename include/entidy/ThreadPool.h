@@ -0,0 +1,361 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace entidy
+{
+using namespace std;
+
+/**
+ * @brief A lock for short critical sections, that spins (yielding) instead of sleeping when it is contended.
+ * Meets the Lockable requirements, so it can be used with lock_guard.
+ */
+class SpinLock
+{
+protected:
+	atomic_flag flag = ATOMIC_FLAG_INIT;
+
+public:
+	void lock()
+	{
+		while(flag.test_and_set(memory_order_acquire))
+			this_thread::yield();
+	}
+
+	bool try_lock()
+	{
+		return !flag.test_and_set(memory_order_acquire);
+	}
+
+	void unlock()
+	{
+		flag.clear(memory_order_release);
+	}
+};
+
+class ThreadPoolImpl;
+using ThreadPool = shared_ptr<ThreadPoolImpl>;
+
+/**
+ * @brief A work-stealing thread pool.
+ * Every worker owns a queue of tasks: it runs its own tasks newest first, and steals the oldest tasks of the other
+ * workers when its queue is empty. Threads that wait for tasks to complete run pending tasks in the meantime, and sleep
+ * when there are none, so tasks can submit and wait for other tasks without deadlocking the pool.
+ * Worker threads are started on first use.
+ */
+class ThreadPoolImpl
+{
+protected:
+	struct Queue
+	{
+		mutex lock;
+		deque<function<void()>> tasks;
+	};
+
+	size_t thread_count;
+	vector<thread> threads;
+	vector<unique_ptr<Queue>> queues;
+	atomic<bool> started{false};
+	mutex start_lock;
+
+	// Counted before a task is queued and after it is taken, so it is never lower than the number of queued tasks
+	atomic<size_t> pending{0};
+	atomic<size_t> next{0};
+	atomic<bool> stop{false};
+	mutex sleep_lock;
+	condition_variable wake;
+	// Threads blocked in Wait, woken when a task is queued or returns; guarded by sleep_lock
+	size_t waiters = 0;
+	condition_variable idle;
+
+	/**
+     * @brief Returns the index of the queue owned by the calling thread, or SIZE_MAX if it is not a worker of this pool.
+     */
+	size_t WorkerIndex() const
+	{
+		return Worker().first == this ? Worker().second : SIZE_MAX;
+	}
+
+	/**
+     * @brief Returns the pool and queue index of the calling thread.
+     */
+	static pair<const ThreadPoolImpl*, size_t>& Worker()
+	{
+		static thread_local pair<const ThreadPoolImpl*, size_t> worker{nullptr, SIZE_MAX};
+		return worker;
+	}
+
+	/**
+     * @brief Starts the worker threads, the first time the pool is used.
+     */
+	void Start()
+	{
+		if(started)
+			return;
+
+		lock_guard<mutex> guard(start_lock);
+		if(started)
+			return;
+
+		stop = false;
+		pending = 0;
+		queues.clear();
+		for(size_t i = 0; i < thread_count; i++)
+			queues.push_back(make_unique<Queue>());
+
+		// The calling thread takes part in the work, so one thread less is started
+		for(size_t i = 1; i < thread_count; i++)
+			threads.emplace_back([this, i]() { Run(i); });
+
+		started = true;
+	}
+
+	/**
+     * @brief Stops and joins the worker threads.
+     */
+	void Stop()
+	{
+		lock_guard<mutex> guard(start_lock);
+		if(!started)
+			return;
+
+		{
+			lock_guard<mutex> sleep_guard(sleep_lock);
+			stop = true;
+		}
+		wake.notify_all();
+
+		for(auto& t : threads)
+			t.join();
+		threads.clear();
+		started = false;
+	}
+
+	/**
+     * @brief Takes a task from queue 'index', or steals one from another queue.
+     * @param index The queue of the calling thread, or SIZE_MAX to only steal.
+     * @param task Receives the task.
+     * @return true if a task was found, false otherwise.
+     */
+	bool Take(size_t index, function<void()>& task)
+	{
+		if(index < queues.size())
+		{
+			Queue& own = *queues[index];
+			lock_guard<mutex> guard(own.lock);
+			if(!own.tasks.empty())
+			{
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				pending--;
+				return true;
+			}
+		}
+
+		size_t start = index < queues.size() ? index + 1 : 0;
+		for(size_t k = 0; k < queues.size(); k++)
+		{
+			Queue& victim = *queues[(start + k) % queues.size()];
+			lock_guard<mutex> guard(victim.lock);
+			if(!victim.tasks.empty())
+			{
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				pending--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+     * @brief Wakes the threads blocked in Wait after a task returned, so that they check whether they are done.
+     */
+	void Completed()
+	{
+		{
+			lock_guard<mutex> guard(sleep_lock);
+			if(waiters == 0)
+				return;
+		}
+		idle.notify_all();
+	}
+
+	/**
+     * @brief Main loop of a worker thread.
+     * @param index The queue owned by the worker.
+     */
+	void Run(size_t index)
+	{
+		Worker() = {this, index};
+
+		function<void()> task;
+		while(true)
+		{
+			if(Take(index, task))
+			{
+				task();
+				task = nullptr;
+				Completed();
+				continue;
+			}
+
+			unique_lock<mutex> guard(sleep_lock);
+			wake.wait(guard, [this]() { return stop || pending > 0; });
+			if(stop)
+				return;
+		}
+	}
+
+public:
+	/**
+     * @brief Creates a thread pool. No threads are started until the pool is first used.
+     * @param threads The number of threads that run tasks, including the thread that waits for them.
+     * Defaults to the number of hardware threads.
+     */
+	ThreadPoolImpl(size_t threads = 0)
+		: thread_count{threads == 0 ? max(1u, thread::hardware_concurrency()) : threads}
+	{ }
+
+	ThreadPoolImpl(const ThreadPoolImpl&) = delete;
+	ThreadPoolImpl& operator=(const ThreadPoolImpl&) = delete;
+
+	/**
+     * @brief Stops and joins the worker threads. Pending tasks are discarded.
+     */
+	~ThreadPoolImpl()
+	{
+		Stop();
+	}
+
+	/**
+     * @brief Changes the number of threads of the pool.
+     * WARNING: Must not be called while tasks are running.
+     * @param threads The number of threads, including the thread that waits for tasks; 0 for the number of hardware threads.
+     */
+	void Resize(size_t threads)
+	{
+		Stop();
+		thread_count = threads == 0 ? max(1u, thread::hardware_concurrency()) : threads;
+	}
+
+	/**
+     * @brief Returns the number of threads that run tasks, including the thread that waits for them.
+     * @return The number of threads.
+     */
+	size_t Size() const
+	{
+		return thread_count;
+	}
+
+	/**
+     * @brief Queues a task. Tasks queued by a worker go to its own queue, others are spread over all the queues.
+     * @param task The task.
+     */
+	void Submit(function<void()> task)
+	{
+		Start();
+
+		size_t index = WorkerIndex();
+		if(index == SIZE_MAX)
+			index = next++ % queues.size();
+
+		bool waiting;
+		{
+			lock_guard<mutex> guard(sleep_lock);
+			pending++;
+			waiting = waiters > 0;
+		}
+		{
+			lock_guard<mutex> guard(queues[index]->lock);
+			queues[index]->tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+		if(waiting)
+			idle.notify_all();
+	}
+
+	/**
+     * @brief Runs pending tasks until 'done' returns true, and sleeps while there are none to run.
+     * @param done A predicate that tells when to stop waiting; its result must only change when a task of the pool returns.
+     */
+	template <typename F>
+	void Wait(F&& done)
+	{
+		size_t index = WorkerIndex();
+		function<void()> task;
+		while(!done())
+		{
+			if(Take(index, task))
+			{
+				task();
+				task = nullptr;
+				Completed();
+				continue;
+			}
+
+			unique_lock<mutex> guard(sleep_lock);
+			waiters++;
+			idle.wait(guard, [this, &done]() { return pending > 0 || done(); });
+			waiters--;
+		}
+	}
+
+	/**
+     * @brief Calls fn(i) for every i in [0, count) across the threads of the pool, and waits for all the calls to return.
+     * The calling thread takes part in the work.
+     * @param count The number of calls.
+     * @param fn Any functor or lambda that expects a size_t; must be safe to call concurrently.
+     * @throw The first exception thrown by 'fn', after all the calls returned.
+     */
+	template <typename F>
+	void For(size_t count, F&& fn)
+	{
+		if(count == 0)
+			return;
+
+		if(thread_count == 1 || count == 1)
+		{
+			for(size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		atomic<size_t> remaining{count};
+		exception_ptr error;
+		mutex error_lock;
+
+		auto run = [&](size_t i) {
+			try
+			{
+				fn(i);
+			}
+			catch(...)
+			{
+				lock_guard<mutex> guard(error_lock);
+				if(!error)
+					error = current_exception();
+			}
+			remaining--;
+		};
+
+		for(size_t i = 1; i < count; i++)
+			Submit([&run, i]() { run(i); });
+		run(0);
+
+		Wait([&remaining]() { return remaining == 0; });
+
+		if(error)
+			rethrow_exception(error);
+	}
+};
+
+} // namespace entidy
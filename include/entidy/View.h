@@ -1,99 +1,365 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <tuple>
 #include <type_traits>
 #include <typeinfo>
+#include <utility>
 #include <vector>
 
+#include <entidy/Archetype.h>
+#include <entidy/ChangeTracker.h>
+#include <entidy/CRoaring/roaring.hh>
 #include <entidy/Entidy.h>
+#include <entidy/Entity.h>
 #include <entidy/Indexer.h>
 #include <entidy/SparseVector.h>
+#include <entidy/ThreadPool.h>
+
+#ifndef ENTIDY_VIEW_BATCH_SIZE
+#	define ENTIDY_VIEW_BATCH_SIZE 256
+#endif
+
+#ifndef ENTIDY_PARALLEL_GRAIN
+#	define ENTIDY_PARALLEL_GRAIN 4096
+#endif
 
 namespace entidy
 {
 using namespace std;
 
-using Entity = uint32_t;
+using BitMap = Roaring;
 
 class IndexerImpl;
 
 class View
 {
 protected:
-	vector<vector<intptr_t>> data;
+	BitMap entities;
+	vector<ArchetypeSlice> slices;
+	vector<SparseVector<ENTIDY_DEFAULT_SV_SIZE>> columns;
 	vector<size_t> types;
+	SparseVector<ENTIDY_DEFAULT_SV_SIZE> generations;
+	size_t size;
+	ThreadPool pool;
+
+	// The trackers of the selected components, if any is tracked, and the epoch in which the view was created
+	vector<ChangeTracker> trackers;
+	size_t epoch;
 
-	View(const vector<vector<intptr_t>>& data_list, const vector<size_t>& type_list)
-		: data(data_list)
+	mutable vector<Entity> rows;
+
+	View(BitMap&& entity_map, const vector<SparseVector<ENTIDY_DEFAULT_SV_SIZE>>& column_list, const vector<size_t>& type_list,
+		 SparseVector<ENTIDY_DEFAULT_SV_SIZE> generation_list, ThreadPool thread_pool)
+		: entities(std::move(entity_map))
+		, columns(column_list)
 		, types(type_list)
+		, generations(generation_list)
+		, size(entities.cardinality())
+		, pool(thread_pool)
+		, trackers{}
+		, epoch(0)
+		, rows{}
 	{ }
 
-public:
-	template <class Ld>
-	struct lambda_type : lambda_type<decltype(&Ld::operator())>
-	{ };
+	View(vector<ArchetypeSlice>&& slice_list, const vector<SparseVector<ENTIDY_DEFAULT_SV_SIZE>>& column_list, const vector<size_t>& type_list,
+		 SparseVector<ENTIDY_DEFAULT_SV_SIZE> generation_list, ThreadPool thread_pool)
+		: entities{}
+		, slices(std::move(slice_list))
+		, columns(column_list)
+		, types(type_list)
+		, generations(generation_list)
+		, size(0)
+		, pool(thread_pool)
+		, trackers{}
+		, epoch(0)
+		, rows{}
+	{
+		for(auto& slice : slices)
+			size += slice.table->Size();
+	}
 
-	template <class Ret, class Cls, class... Args>
-	struct lambda_type<Ret (Cls::*)(Args...) const>
+	/**
+     * @brief Returns the handle of the entity at index 'entity', with its current generation.
+     */
+	Entity Handle(Entity entity) const
 	{
-		vector<vector<intptr_t>> data;
-		vector<size_t> types;
+		if constexpr(ENTIDY_GENERATION_BITS > 0)
+			return entity | Entity(generations->Read(entity));
+		else
+			return entity;
+	}
 
-		template <size_t Nmax, size_t N, typename Head, typename... Rest>
-		constexpr std::tuple<Head, Rest...> GetIndirection(size_t index) const
+	/**
+     * @brief Materializes the list of entities in the view, the first time random access is requested.
+     */
+	void MaterializeRows() const
+	{
+		if(rows.size() == size)
+			return;
+
+		if(slices.empty())
 		{
-			if constexpr(N == 1)
-				return std::make_tuple(static_cast<Head>((typename std::decay<Head>::type)data[data.size() - N][index]));
+			rows.resize(size);
+			entities.toUint32Array(rows.data());
+			return;
+		}
 
-			else if constexpr(N == Nmax)
-				return std::tuple_cat(std::make_tuple(static_cast<Head>(data[0][index])), GetGenerator<Nmax, N - 1, Rest...>(index));
+		rows.clear();
+		rows.reserve(size);
+		for(auto& slice : slices)
+			for(size_t row = 0; row < slice.table->Size(); row++)
+				rows.push_back(EntityIndex(Entity(slice.table->Cell(row, 0))));
+	}
 
-			else
-				return std::tuple_cat(std::make_tuple(static_cast<Head>((typename std::decay<Head>::type)data[data.size() - N][index])), GetGenerator<Nmax, N - 1, Rest...>(index));
+	/**
+     * @brief Marks every entity in the view as changed, for the tracked components among the first 'cols' selected components.
+     */
+	void MarkChanged(size_t cols) const
+	{
+		cols = min(cols, trackers.size());
+		if(none_of(trackers.begin(), trackers.begin() + cols, [](const ChangeTracker& tracker) { return bool(tracker); }))
+			return;
+
+		BitMap marked;
+		if(slices.empty())
+		{
+			marked = entities;
+		}
+		else
+		{
+			MaterializeRows();
+			marked.addMany(rows.size(), rows.data());
 		}
 
-		template <size_t Nmax, size_t N, typename... T>
-		constexpr std::tuple<T...> GetGenerator(size_t index) const
+		for(size_t k = 0; k < cols; k++)
+			if(trackers[k])
+				trackers[k]->Mark(epoch, marked);
+	}
+
+	/**
+     * @brief Applies the provided functor on the rows of the entities in [begin, end), in order.
+     * Entities are decoded from the result bitmap in small batches and component pointers, as well as entity
+     * generations, are read directly from the pages of the sparse vectors. The functor's types must have been checked.
+     * @param fn Any functor or lambda that expects Entity, followed by pointers to selected component types.
+     * @param begin The first entity of the range.
+     * @param end The entity after the last entity of the range.
+     */
+	template <typename F>
+	void EachInRange(F& fn, uint64_t begin, uint64_t end) const
+	{
+		using lt = lambda_type<std::decay_t<F>>;
+		constexpr size_t cols = lt::arity > 0 ? lt::arity - 1 : 0;
+
+		std::array<const Page<ENTIDY_DEFAULT_SV_SIZE>*, cols + 1> pages{};
+		std::array<intptr_t, cols + 1> row{};
+		size_t page_index = SIZE_MAX;
+
+		Entity batch[ENTIDY_VIEW_BATCH_SIZE];
+		roaring_uint32_iterator_t it;
+		roaring_init_iterator(&entities.roaring, &it);
+		if(begin > 0 && !roaring_move_uint32_iterator_equalorlarger(&it, uint32_t(begin)))
+			return;
+
+		uint32_t count;
+		bool last = false;
+		while(!last && (count = roaring_read_uint32_iterator(&it, batch, ENTIDY_VIEW_BATCH_SIZE)) > 0)
 		{
-			return GetIndirection<Nmax, N, T...>(index);
+			if(batch[count - 1] >= end)
+			{
+				count = uint32_t(lower_bound(batch, batch + count, end, [](Entity e, uint64_t v) { return e < v; }) - batch);
+				last = true;
+			}
+
+			for(uint32_t b = 0; b < count; b++)
+			{
+				Entity entity = batch[b];
+				size_t cur_page = entity / ENTIDY_DEFAULT_SV_SIZE;
+				size_t cell = entity - cur_page * ENTIDY_DEFAULT_SV_SIZE;
+
+				if(cur_page != page_index)
+				{
+					page_index = cur_page;
+					for(size_t k = 0; k < cols; k++)
+						pages[k] = columns[k]->GetPage(page_index);
+					if constexpr(ENTIDY_GENERATION_BITS > 0)
+						pages[cols] = generations->GetPage(page_index);
+				}
+
+				row[0] = entity;
+				if constexpr(ENTIDY_GENERATION_BITS > 0)
+					row[0] |= pages[cols] == nullptr ? 0 : pages[cols]->data[cell];
+				for(size_t k = 0; k < cols; k++)
+					row[k + 1] = pages[k] == nullptr ? 0 : pages[k]->data[cell];
+
+				std::apply(fn, lt::Get(row.data()));
+			}
 		}
+	}
 
-		constexpr tuple<Args...> Get(size_t index)
+	/**
+     * @brief Applies the provided functor on the rows of chunks [first, last) of an archetype table, in order.
+     * Entity handles and component pointers are read linearly from the columns of the chunks. The functor's types must have been checked.
+     * @param fn Any functor or lambda that expects Entity, followed by pointers to selected component types.
+     * @param slice The table and the columns of the selected components.
+     * @param first The first chunk.
+     * @param last The chunk after the last chunk.
+     */
+	template <typename F>
+	void EachInTable(F& fn, const ArchetypeSlice& slice, size_t first, size_t last) const
+	{
+		using lt = lambda_type<std::decay_t<F>>;
+		constexpr size_t cols = lt::arity > 0 ? lt::arity - 1 : 0;
+
+		const ArchetypeTableImpl& table = *slice.table;
+		std::array<const intptr_t*, cols + 1> cells{};
+		std::array<intptr_t, cols + 1> row{};
+
+		for(size_t c = first; c < last && c < table.Chunks(); c++)
 		{
-			return GetGenerator<sizeof...(Args), sizeof...(Args), Args...>(index);
+			const intptr_t* chunk = table.Chunk(c);
+			size_t count = min(table.Size() - c * ENTIDY_ARCHETYPE_CHUNK_SIZE, size_t(ENTIDY_ARCHETYPE_CHUNK_SIZE));
+
+			cells[0] = chunk;
+			for(size_t k = 0; k < cols; k++)
+				cells[k + 1] = chunk + slice.columns[k] * ENTIDY_ARCHETYPE_CHUNK_SIZE;
+
+			for(size_t r = 0; r < count; r++)
+			{
+				for(size_t k = 0; k <= cols; k++)
+					row[k] = cells[k][r];
+				std::apply(fn, lt::Get(row.data()));
+			}
 		}
+	}
+
+	/**
+     * @brief Splits the chunks of the archetype tables of the view into runs of at least 'grain' entities, for parallel iteration.
+     * Runs never span two tables.
+     * @param grain The minimum number of entities per run.
+     * @return The list of (slice, first chunk, last chunk) runs, in order.
+     */
+	vector<tuple<size_t, size_t, size_t>> TableChunks(size_t grain) const
+	{
+		size_t step = max(grain / ENTIDY_ARCHETYPE_CHUNK_SIZE, size_t(1));
 
-		template <size_t N, typename Head, typename... Rest>
-		constexpr void TypeCheckIndirection() const
+		vector<tuple<size_t, size_t, size_t>> runs;
+		for(size_t i = 0; i < slices.size(); i++)
+			for(size_t c = 0; c < slices[i].table->Chunks(); c += step)
+				runs.push_back({i, c, c + step});
+		return runs;
+	}
+
+	/**
+     * @brief Splits the entities of the view into ranges of at least 'grain' entities, for parallel iteration.
+     * Ranges are made of whole containers of the result bitmap, so that no container is decoded by two threads,
+     * unless a single container holds more than twice 'grain' entities; such containers are split into equal ranges
+     * aligned to the pages of the sparse vectors.
+     * @param grain The minimum number of entities per range.
+     * @return The list of [begin, end) ranges, in order.
+     */
+	vector<pair<uint64_t, uint64_t>> Chunks(size_t grain) const
+	{
+		constexpr uint64_t span = uint64_t(1) << 16;
+		const roaring_array_t& ra = entities.roaring.high_low_container;
+
+		vector<pair<uint64_t, uint64_t>> chunks;
+		uint64_t begin = 0;
+		size_t count = 0;
+
+		for(int32_t i = 0; i < ra.size; i++)
 		{
-			if constexpr(N == 1)
+			uint64_t key = uint64_t(ra.keys[i]) << 16;
+			size_t cardinality = container_get_cardinality(ra.containers[i], ra.typecodes[i]);
+
+			if(cardinality >= 2 * grain)
 			{
-				if(types[types.size() - N] != 0 && typeid(Head).hash_code() != types[types.size() - N])
-					throw(EntidyException("Type mismatch for class " + string(typeid(Head).name())));
+				if(count > 0)
+					chunks.push_back({begin, key});
+
+				size_t parts = cardinality / grain;
+				uint64_t step = (span / parts + ENTIDY_DEFAULT_SV_SIZE - 1) / ENTIDY_DEFAULT_SV_SIZE * ENTIDY_DEFAULT_SV_SIZE;
+				for(uint64_t lo = key; lo < key + span; lo += step)
+					chunks.push_back({lo, min(lo + step, key + span)});
+
+				begin = key + span;
+				count = 0;
+				continue;
 			}
-			else
+
+			if(count == 0)
+				begin = key;
+			count += cardinality;
+			if(count >= grain)
 			{
-				if(types[types.size() - N] != 0 && typeid(Head).hash_code() != types[types.size() - N])
-					throw(EntidyException("Type mismatch for class " + string(typeid(Head).name())));
-				TypeCheckGenerator<N - 1, Rest...>();
+				chunks.push_back({begin, key + span});
+				count = 0;
 			}
 		}
 
-		template <size_t N, typename... T>
-		constexpr void TypeCheckGenerator() const
+		if(count > 0)
+			chunks.push_back({begin, uint64_t(UINT32_MAX) + 1});
+
+		return chunks;
+	}
+
+public:
+	template <class Ld>
+	struct lambda_type : lambda_type<decltype(&Ld::operator())>
+	{ };
+
+	template <class Ret, class Cls, class... Args>
+	struct lambda_type<Ret (Cls::*)(Args...) const>
+	{
+		static constexpr size_t arity = sizeof...(Args);
+
+		template <typename Head>
+		static constexpr Head Cast(intptr_t value)
+		{
+			return static_cast<Head>((typename std::decay<Head>::type)value);
+		}
+
+		template <size_t... I>
+		static constexpr tuple<Args...> GetIndirection(const intptr_t* row, std::index_sequence<I...>)
+		{
+			return tuple<Args...>(Cast<Args>(row[I])...);
+		}
+
+		static constexpr tuple<Args...> Get(const intptr_t* row)
+		{
+			return GetIndirection(row, std::index_sequence_for<Args...>{});
+		}
+
+		template <typename Head>
+		static void TypeCheckIndirection(size_t type)
+		{
+			if(type != 0 && typeid(Head).hash_code() != type)
+				throw(EntidyException("Type mismatch for class " + string(typeid(Head).name())));
+		}
+
+		template <size_t... I>
+		static void TypeCheckGenerator(const vector<size_t>& types, std::index_sequence<I...>)
 		{
-			TypeCheckIndirection<N, T...>();
+			(TypeCheckIndirection<Args>(types[I]), ...);
 		}
 
-		constexpr void TypeCheck()
+		static void TypeCheck(const vector<size_t>& types)
 		{
-			TypeCheckGenerator<sizeof...(Args), Args...>();
+			if(arity > types.size())
+				throw(EntidyException("Too many arguments; only " + to_string(types.size() - 1) + " components were selected"));
+			TypeCheckGenerator(types, std::index_sequence_for<Args...>{});
 		}
 	};
 
 	/**
      * @brief Iterate over all entities in the view, applying the provided functor on each row.
      * The functor must receive Entity followed by pointers to component types in the order they figure in Entidy::Select.
+     * Entities are decoded from the result bitmap in small batches and component pointers are read directly from
+     * the pages of the component sparse vectors, so iterating does not allocate memory proportional to the view size.
+     * Views of compiled queries with IterationPolicy::Archetype scan the rows of the matching archetype tables instead;
+     * entities are then grouped by signature rather than ordered.
      * @param fn Any functor or lambda that expects Entity, followed by pointers to selected component types.
      * @throw EntidyException if any of the pointer types in the provided functor does not match with the type associated to the component.
      * @example
@@ -103,19 +369,90 @@ public:
 	template <typename F>
 	void Each(F&& fn) const
 	{
-		if(data[0].size() == 0)
+		using lt = lambda_type<std::decay_t<F>>;
+
+		if(size == 0)
+			return;
+
+		lt::TypeCheck(types);
+		if(!slices.empty())
+		{
+			for(auto& slice : slices)
+				EachInTable(fn, slice, 0, slice.table->Chunks());
+			return;
+		}
+		EachInRange(fn, 0, uint64_t(UINT32_MAX) + 1);
+	}
+
+	/**
+     * @brief Iterate over all entities in the view like Each, and mark them as changed for the tracked components the functor receives.
+     * Intended for systems that write to their components, so that queries using Changed see their writes after the next commit.
+     * @param fn Any functor or lambda that expects Entity, followed by pointers to selected component types.
+     * @throw EntidyException if any of the pointer types in the provided functor does not match with the type associated to the component.
+     * @example
+     * auto view = entidy.Select({"Position", "Velocity"}).Having("Position & Velocity");
+     * view.EachMut([](Entity e, Vec2f* position, Vec2f* velocity){ *position += *velocity; });
+     */
+	template <typename F>
+	void EachMut(F&& fn) const
+	{
+		using lt = lambda_type<std::decay_t<F>>;
+
+		Each(fn);
+		if(size > 0)
+			MarkChanged(lt::arity > 0 ? lt::arity - 1 : 0);
+	}
+
+	/**
+     * @brief Iterate over all entities in the view in parallel, applying the provided functor on each row.
+     * The view is split into chunks of at least 'grain' entities, aligned to the containers of the result bitmap
+     * (blocks of 65536 consecutive entities), that are run across the threads of the registry's thread pool.
+     * Entities are visited in order within a chunk, but chunks run concurrently and in no particular order.
+     * Views over archetype tables are split into runs of table chunks instead.
+     * The functor must receive Entity followed by pointers to component types in the order they figure in Entidy::Select,
+     * and must be safe to call concurrently. Changes can be recorded from it, as long as their keys exist (see Entidy::Declare).
+     * @param fn Any functor or lambda that expects Entity, followed by pointers to selected component types.
+     * @param grain The minimum number of entities per chunk.
+     * @throw EntidyException if any of the pointer types in the provided functor does not match with the type associated to the component.
+     * @example
+     * auto view = entidy.Select({"Position", "Velocity"}).Having("Position & Velocity");
+     * view.ParallelEach([](Entity e, Vec2f* position, Vec2f* velocity){ *position += *velocity; });
+     */
+	template <typename F>
+	void ParallelEach(F&& fn, size_t grain = ENTIDY_PARALLEL_GRAIN) const
+	{
+		using lt = lambda_type<std::decay_t<F>>;
+
+		if(size == 0)
 			return;
 
-		lambda_type<F> lt;
-		lt.data = data;
-		lt.types = types;
+		lt::TypeCheck(types);
 
-		lt.TypeCheck();
+		if(!slices.empty())
+		{
+			vector<tuple<size_t, size_t, size_t>> runs = TableChunks(grain);
+			if(runs.size() == 1 || !pool || pool->Size() == 1)
+			{
+				for(auto& slice : slices)
+					EachInTable(fn, slice, 0, slice.table->Chunks());
+				return;
+			}
+
+			pool->For(runs.size(), [&](size_t i) {
+				auto& [slice, first, last] = runs[i];
+				EachInTable(fn, slices[slice], first, last);
+			});
+			return;
+		}
 
-		for(size_t index = 0; index < data[0].size(); index++)
+		vector<pair<uint64_t, uint64_t>> chunks = Chunks(max(grain, size_t(1)));
+		if(chunks.size() == 1 || !pool || pool->Size() == 1)
 		{
-			std::apply(fn, lt.Get(index));
+			EachInRange(fn, 0, uint64_t(UINT32_MAX) + 1);
+			return;
 		}
+
+		pool->For(chunks.size(), [&](size_t i) { EachInRange(fn, chunks[i].first, chunks[i].second); });
 	}
 
 	/**
@@ -124,11 +461,12 @@ public:
      */
 	size_t Size() const
 	{
-		return data[0].size();
+		return size;
 	}
 
 	/**
      * @brief Returns a pointer to the component at Col for entity at row Row.
+     * The first call to At materializes the list of entities in the view.
      * @tparam Type The component type. 
      * @tparam Col The position of the component in the order set by Entidy::Select.
      * @return A pointer to the requested component.
@@ -139,16 +477,19 @@ public:
 	{
 		if(typeid(Type*).hash_code() != types[Col + 1])
 			throw(EntidyException("Type mismatch for class " + string(typeid(Type).name())));
-		return reinterpret_cast<Type*>(data[Col + 1][row]);
+		MaterializeRows();
+		return reinterpret_cast<Type*>(columns[Col]->Read(rows[row]));
 	}
 
 	/**
      * @brief Returns the entity at requested row.
+     * The first call to At materializes the list of entities in the view.
      * @return the Entity at selected row.
      */
 	Entity At(size_t row)
 	{
-		return static_cast<Entity>(data[0][row]);
+		MaterializeRows();
+		return Handle(rows[row]);
 	}
 
 	friend IndexerImpl;